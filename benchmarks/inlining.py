@@ -0,0 +1,79 @@
+"""
+Benchmark of calls with literal arguments in declarative macro bodies.
+
+Writes an input in which every line calls `top!`, whose body calls a chain of macros `depth`
+levels deep with literal arguments of `width` items, runs `macten run` on it and prints the best wall time of a
+few runs. Such calls are inlined when the macros are defined. If a reference executable is
+given, it is run on the same input and its output must be byte-identical.
+
+Usage: python3 inlining.py <macten executable> [reference executable] [depth] [width] [lines] [runs]
+"""
+
+import filecmp
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def definitions(depth: int, width: int) -> str:
+    # Level n calls level n + 1 with a list of `width` literal items, and keeps only the first.
+    # Calls with long arguments are not memoized.
+    items = "".join(f"{item}, " for item in range(width))
+    levels = []
+    for level in range(depth):
+        call = f"l{level + 1}![{items}]" if level + 1 < depth else "end"
+        levels.append(f"defmacten_dec l{level} {{\n  ($x, $($y,)) => {{l{level}($x, {call})}}\n}}\n")
+    levels.append(f"defmacten_dec top {{\n  ($x) => {{top($x, l0![{items}])}}\n}}\n")
+    return "\n".join(levels) + "\n"
+
+
+def write_input(path: str, depth: int, width: int, lines: int) -> None:
+    with open(path, "w") as source:
+        source.write(definitions(depth, width))
+        for line in range(lines):
+            source.write(f"a{line} = top![(x{line})]\n")
+
+
+def best_time(executable: str, source: str, output: str, runs: int) -> float:
+    best = float("inf")
+    for _ in range(runs):
+        start = time.perf_counter()
+        subprocess.run([executable, "run", source, output], check=True, capture_output=True)
+        best = min(best, time.perf_counter() - start)
+    return best
+
+
+def main() -> None:
+    if len(sys.argv) < 2:
+        print(__doc__.strip())
+        sys.exit(1)
+
+    executable = sys.argv[1]
+    reference = sys.argv[2] if len(sys.argv) > 2 and sys.argv[2] != "-" else None
+    depth = int(sys.argv[3]) if len(sys.argv) > 3 else 4
+    width = int(sys.argv[4]) if len(sys.argv) > 4 else 400
+    lines = int(sys.argv[5]) if len(sys.argv) > 5 else 2000
+    runs = int(sys.argv[6]) if len(sys.argv) > 6 else 5
+
+    with tempfile.TemporaryDirectory() as directory:
+        source = os.path.join(directory, "inlining.py")
+        output = os.path.join(directory, "inlining.macten.py")
+        write_input(source, depth, width, lines)
+
+        best = best_time(executable, source, output, runs)
+        print(f"depth {depth}, width {width}, {lines} lines: {best * 1000:.1f} ms")
+
+        if reference is not None:
+            expected = os.path.join(directory, "inlining.reference.py")
+            reference_best = best_time(reference, source, expected, runs)
+            print(f"reference: {reference_best * 1000:.1f} ms")
+
+            if not filecmp.cmp(output, expected, shallow=False):
+                print("output differs from the reference")
+                sys.exit(1)
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,144 @@
+/**
+ * Benchmark of keyword recognition: the compile-time KeywordTable against the MATCH/do_trie trie
+ * identifier_type() used before.
+ *
+ * Collects every identifier of the given files, checks that both lookups agree on each of them,
+ * then prints the best time per lookup of a few passes over all of them.
+ *
+ * Build: g++ -std=c++20 -O2 keywords.cpp -o keywords
+ * Usage: ./keywords <file>... [--runs=N]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../src/macten_tokens.hpp"
+
+/**
+ * The lookup identifier_type() used to do, generated from the same descriptor file.
+ */
+auto trie_lookup(std::string_view word) -> MactenToken
+{
+ return MATCH(word)
+  return MactenToken::Identifier;
+ #define KEYWORD_TOKEN(name, symbol) CASE(symbol) return MactenToken::name;
+ #define SYMBOL_TOKEN(name, symbol)
+ #define IGNORE_TOKEN(character)
+ #include "../src/macten_tokens.def"
+ #undef SYMBOL_TOKEN
+ #undef KEYWORD_TOKEN
+ #undef IGNORE_TOKEN
+ ENDMATCH;
+}
+
+auto table_lookup(std::string_view word) -> MactenToken
+{
+ return MactenTokenScanner::keywords.find(word).value_or(MactenToken::Identifier);
+}
+
+/**
+ * Tables the search cannot make perfect still find every keyword.
+ */
+constexpr cpp20scanner::KeywordEntry<MactenToken> clashing_entries[] = {
+ {"defmacten_dec", MactenToken::DeclarativeDefinition},
+ {"defmacten_doc", MactenToken::ProceduralDefinition},
+ {},
+};
+constexpr cpp20scanner::KeywordTable clashing{clashing_entries};
+static_assert(!clashing.is_perfect());
+static_assert(clashing.find("defmacten_dec") == MactenToken::DeclarativeDefinition);
+static_assert(clashing.find("defmacten_doc") == MactenToken::ProceduralDefinition);
+static_assert(!clashing.find("defmacten_dic"));
+
+/**
+ * Keywords of 64 bytes and more are found.
+ */
+constexpr cpp20scanner::KeywordEntry<MactenToken> long_entries[] = {
+ {"a_keyword_which_is_much_longer_than_sixty_four_bytes_and_then_some", MactenToken::DeclarativeDefinition},
+ {"short", MactenToken::ProceduralDefinition},
+ {},
+};
+constexpr cpp20scanner::KeywordTable long_keywords{long_entries};
+static_assert(long_keywords.is_perfect());
+static_assert(long_keywords.find("a_keyword_which_is_much_longer_than_sixty_four_bytes_and_then_some") == MactenToken::DeclarativeDefinition);
+static_assert(!long_keywords.find("a_keyword_which_is_much_longer_than_sixty_four_bytes_and_then_sum"));
+
+static_assert(MactenTokenScanner::keywords.is_perfect());
+
+template <typename Lookup>
+auto best_time(const std::vector<std::string_view>& words, int runs, Lookup lookup) -> double
+{
+ double best {std::numeric_limits<double>::max()};
+ std::size_t keywords {0};
+
+ for (int run {0}; run < runs; run++)
+ {
+  const auto start = std::chrono::steady_clock::now();
+  for (const auto word : words) keywords += lookup(word) != MactenToken::Identifier;
+  const std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+  best = std::min(best, elapsed.count());
+ }
+
+ // Keep the lookups from being optimized away.
+ if (keywords == std::numeric_limits<std::size_t>::max()) std::printf("\n");
+
+ return best / static_cast<double>(words.size());
+}
+
+auto main(int argc, char* argv[]) -> int
+{
+ int runs {20};
+ std::vector<std::string> files{};
+
+ for (int i {1}; i < argc; i++)
+ {
+  const std::string arg {argv[i]};
+  if (arg.starts_with("--runs=")) runs = std::stoi(arg.substr(7));
+  else files.push_back(arg);
+ }
+
+ if (files.empty())
+ {
+  std::cerr << "Usage: keywords <file>... [--runs=N]" << '\n';
+  return 1;
+ }
+
+ for (const auto& file : files)
+ {
+  MactenTokenScanner scanner{};
+  if (!scanner.read_source(file))
+  {
+   std::cerr << "Failed to read '" << file << "'" << '\n';
+   return 1;
+  }
+
+  std::vector<std::string_view> words{};
+  for (auto token = scanner.scan_token(); token.type != MactenToken::EndOfFile; token = scanner.scan_token())
+  {
+   if (!token.lexeme.empty() && cpp20scanner::classify::is_identifier(token.lexeme.front()) && !cpp20scanner::classify::is_digit(token.lexeme.front()))
+    words.push_back(token.lexeme);
+  }
+
+  for (const auto word : words)
+  {
+   if (trie_lookup(word) != table_lookup(word))
+   {
+    std::cerr << "Lookups disagree on '" << word << "'" << '\n';
+    return 1;
+   }
+  }
+
+  if (words.empty()) continue;
+
+  std::printf("%s: %zu identifiers\n", file.c_str(), words.size());
+  std::printf("  trie  %6.2f ns/lookup\n", best_time(words, runs, trie_lookup));
+  std::printf("  table %6.2f ns/lookup\n", best_time(words, runs, table_lookup));
+ }
+
+ return 0;
+}
@@ -0,0 +1,71 @@
+"""
+Benchmark of inputs with many distinct declarative macros.
+
+Writes an input which defines `macros` macros with literal keyword arms (`add _ to _`,
+`scale _ by _`, `neg _`) and calls them `lines` times, each call nesting up to `depth` levels
+of calls to other macros, runs `macten run` on it and prints the best wall time of a few runs.
+Every call looks its macro up by name and matches the literals of its arms.
+
+Usage: python3 many_macros.py <macten executable> [macros] [lines] [depth] [runs]
+"""
+
+import os
+import random
+import subprocess
+import sys
+import tempfile
+import time
+
+
+def definitions(macros: int) -> str:
+    arms = "  (add $a to $b) => {($a + $b)}\n  (scale $a by $b) => {($a * $b)}\n  (neg $a) => {(-$a)}\n"
+    return "".join(f"defmacten_dec m{macro} {{\n{arms}}}\n\n" for macro in range(macros))
+
+
+def call(rng: random.Random, macros: int, depth: int) -> str:
+    # An argument of more than one token is passed in parentheses.
+    name = f"m{rng.randrange(macros)}"
+    inner = f"({call(rng, macros, depth - 1)})" if depth > 1 else f"v{rng.randrange(100)}"
+    arm = rng.randrange(3)
+    if arm == 0:
+        return f"{name}![add {inner} to {rng.randrange(10)}]"
+    if arm == 1:
+        return f"{name}![scale {inner} by {rng.randrange(10)}]"
+    return f"{name}![neg {inner}]"
+
+
+def write_input(path: str, macros: int, lines: int, depth: int) -> None:
+    rng = random.Random(0)
+    with open(path, "w") as source:
+        source.write(definitions(macros))
+        for line in range(lines):
+            source.write(f"a{line} = {call(rng, macros, rng.randint(1, depth))}\n")
+
+
+def main() -> None:
+    if len(sys.argv) < 2:
+        print(__doc__.strip())
+        sys.exit(1)
+
+    executable = sys.argv[1]
+    macros = int(sys.argv[2]) if len(sys.argv) > 2 else 400
+    lines = int(sys.argv[3]) if len(sys.argv) > 3 else 60000
+    depth = int(sys.argv[4]) if len(sys.argv) > 4 else 9
+    runs = int(sys.argv[5]) if len(sys.argv) > 5 else 5
+
+    with tempfile.TemporaryDirectory() as directory:
+        source = os.path.join(directory, "many_macros.py")
+        output = os.path.join(directory, "many_macros.macten.py")
+        write_input(source, macros, lines, depth)
+
+        best = float("inf")
+        for _ in range(runs):
+            start = time.perf_counter()
+            subprocess.run([executable, "run", source, output], check=True, capture_output=True)
+            best = min(best, time.perf_counter() - start)
+
+    print(f"{macros} macros, {lines} lines, depth up to {depth}: {best * 1000:.1f} ms")
+
+
+if __name__ == "__main__":
+    main()
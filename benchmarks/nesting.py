@@ -0,0 +1,66 @@
+"""
+Benchmark of nested declarative macro calls.
+
+Writes an input in which every call takes the call of the level below it as its argument, `depth`
+levels deep, runs `macten run` on it and prints the best wall time of a few runs. `wrap!` uses its
+argument once, `pair!` twice, so the output of `pair!` doubles with every level.
+
+Usage: python3 nesting.py <macten executable> [depth] [lines] [runs]
+"""
+
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+DEFINITIONS = """defmacten_dec wrap {
+  ($a) => {w($a)}
+}
+
+defmacten_dec pair {
+  ($a) => {p($a, $a)}
+}
+
+"""
+
+
+def nested(macro: str, depth: int, leaf: str) -> str:
+    # An argument of more than one token is passed in parentheses.
+    return f"{macro}![(" * depth + leaf + ")]" * depth
+
+
+def write_input(path: str, depth: int, lines: int) -> None:
+    with open(path, "w") as source:
+        source.write(DEFINITIONS)
+        for line in range(lines):
+            source.write(f"a{line} = {nested('wrap', depth, f'x{line}')}\n")
+            source.write(f"b{line} = {nested('pair', depth, f'y{line}')}\n")
+
+
+def main() -> None:
+    if len(sys.argv) < 2:
+        print(__doc__.strip())
+        sys.exit(1)
+
+    executable = sys.argv[1]
+    depth = int(sys.argv[2]) if len(sys.argv) > 2 else 12
+    lines = int(sys.argv[3]) if len(sys.argv) > 3 else 100
+    runs = int(sys.argv[4]) if len(sys.argv) > 4 else 5
+
+    with tempfile.TemporaryDirectory() as directory:
+        source = os.path.join(directory, "nesting.py")
+        output = os.path.join(directory, "nesting.macten.py")
+        write_input(source, depth, lines)
+
+        best = float("inf")
+        for _ in range(runs):
+            start = time.perf_counter()
+            subprocess.run([executable, "run", source, output], check=True, capture_output=True)
+            best = min(best, time.perf_counter() - start)
+
+    print(f"depth {depth}, {lines} lines: {best * 1000:.1f} ms")
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,88 @@
+/**
+ * Scaling benchmark of the parallel tokenizer.
+ *
+ * Scans the file serially, then in parallel on 1 to N threads, both into a whole TokenStream and
+ * through the batched LazyTokenStream which `macten run` reads its input with, and prints the best
+ * time of a few runs and the speedup over the serial scan.
+ *
+ * Build: g++ -std=c++20 -O2 -pthread parallel_scan.cpp -o parallel_scan
+ * Usage: ./parallel_scan <file> [max threads] [runs]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <thread>
+
+#include "../src/token_stream.hpp"
+
+using Stream = macten::TokenStream<MactenAllToken>;
+using LazyStream = macten::LazyTokenStream<MactenAllToken>;
+
+template <typename Scan>
+auto best_time(int runs, Scan&& scan) -> double
+{
+ double best {std::numeric_limits<double>::max()};
+ for (int run {0}; run < runs; run++)
+ {
+  const auto start = std::chrono::steady_clock::now();
+  scan();
+  const std::chrono::duration<double, std::milli> elapsed = std::chrono::steady_clock::now() - start;
+  best = std::min(best, elapsed.count());
+ }
+ return best;
+}
+
+auto drain(LazyStream stream) -> std::size_t
+{
+ std::size_t count {0};
+ while (!stream.is_at_end())
+ {
+  stream.advance();
+  stream.release_consumed();
+  count++;
+ }
+ return count;
+}
+
+auto main(int argc, char* argv[]) -> int
+{
+ if (argc < 2)
+ {
+  std::cerr << "Usage: parallel_scan <file> [max threads] [runs]" << '\n';
+  return 1;
+ }
+
+ const std::string path {argv[1]};
+ const auto max_threads = argc > 2 ? std::stoul(argv[2]) : std::max(1u, std::thread::hardware_concurrency());
+ const auto runs = argc > 3 ? std::stoi(argv[3]) : 5;
+
+ std::size_t tokens {0};
+ const auto serial = best_time(runs, [&] {
+  MactenAllTokenScanner scanner{};
+  scanner.read_source(path);
+  Stream stream{};
+  stream.pin(scanner.buffer());
+  while (!scanner.is_at_end()) stream.push_back(scanner.scan_token());
+  tokens = stream.size();
+ });
+
+ std::printf("%s: %zu tokens\n", path.c_str(), tokens);
+ std::printf("serial                    %8.1f ms\n", serial);
+
+ for (std::size_t threads {1}; threads <= max_threads; threads++)
+ {
+  const auto whole = best_time(runs, [&] {
+   if (Stream::from_file_parallel(path, threads).size() != tokens) std::exit(1);
+  });
+  const auto lazy = best_time(runs, [&] {
+   if (drain(LazyStream::from_file_parallel(path, threads)) != tokens) std::exit(1);
+  });
+  std::printf("%2zu threads  TokenStream   %8.1f ms  %5.2fx   LazyTokenStream %8.1f ms  %5.2fx\n",
+   threads, whole, serial / whole, lazy, serial / lazy);
+ }
+
+ return 0;
+}
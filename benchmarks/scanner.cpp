@@ -0,0 +1,107 @@
+/**
+ * Scanner throughput microbenchmark.
+ *
+ * Scans every given file with both token sets and prints the best throughput in MB/s of a few
+ * runs, along with a hash of the (type, lexeme) sequence. Build it twice, once as is and once with
+ * CPP20SCANNER_NO_SIMD defined, to compare the vector kernels against the scalar ones; the hashes
+ * of the two builds must agree.
+ *
+ * Build: g++ -std=c++20 -O2 scanner.cpp -o scanner
+ *        g++ -std=c++20 -O2 -DCPP20SCANNER_NO_SIMD scanner.cpp -o scanner_scalar
+ * Usage: ./scanner <file>... [--runs=N]
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <functional>
+#include <iostream>
+#include <limits>
+#include <string>
+#include <string_view>
+#include <vector>
+
+#include "../src/macten_all_tokens.hpp"
+#include "../src/macten_tokens.hpp"
+
+struct Result
+{
+ double seconds {std::numeric_limits<double>::max()};
+ std::size_t hash {0};
+};
+
+template <typename TokenType>
+auto scan(const std::shared_ptr<const cpp20scanner::SourceBuffer>& buffer, int runs) -> Result
+{
+ Result result{};
+
+ for (int run {0}; run < runs; run++)
+ {
+  const auto start = std::chrono::steady_clock::now();
+
+  typename TokenType::Scanner scanner{};
+  scanner.set_buffer(buffer);
+  while (scanner.scan_token().type != TokenType::EndOfFile) {}
+
+  const std::chrono::duration<double> elapsed = std::chrono::steady_clock::now() - start;
+  result.seconds = std::min(result.seconds, elapsed.count());
+ }
+
+ // Hashed in a separate pass so that hashing the lexemes is not part of the timing.
+ typename TokenType::Scanner scanner{};
+ scanner.set_buffer(buffer);
+ for (auto token = scanner.scan_token(); token.type != TokenType::EndOfFile; token = scanner.scan_token())
+ {
+  result.hash = result.hash * 31 + static_cast<std::size_t>(token.type.as_int());
+  result.hash = result.hash * 31 + std::hash<std::string_view>{}(token.lexeme);
+ }
+
+ return result;
+}
+
+auto report(const char* token_set, std::size_t bytes, const Result& result) -> void
+{
+ const auto megabytes = static_cast<double>(bytes) / (1024.0 * 1024.0);
+ std::printf("  %-16s %8.1f MB/s  %016zx\n", token_set, megabytes / result.seconds, result.hash);
+}
+
+auto main(int argc, char* argv[]) -> int
+{
+ int runs {5};
+ std::vector<std::string> files{};
+
+ for (int i {1}; i < argc; i++)
+ {
+  const std::string arg {argv[i]};
+  if (arg.starts_with("--runs=")) runs = std::stoi(arg.substr(7));
+  else files.push_back(arg);
+ }
+
+ if (files.empty())
+ {
+  std::cerr << "Usage: scanner <file>... [--runs=N]" << '\n';
+  return 1;
+ }
+
+#ifdef CPP20SCANNER_HAS_SIMD
+ std::printf("kernels: simd (picked at runtime)\n");
+#else
+ std::printf("kernels: scalar\n");
+#endif
+
+ for (const auto& file : files)
+ {
+  const auto buffer = cpp20scanner::SourceBuffer::from_file(file);
+  if (buffer == nullptr)
+  {
+   std::cerr << "Failed to read '" << file << "'" << '\n';
+   return 1;
+  }
+
+  const auto bytes = buffer->view().size();
+  std::printf("%s (%.1f MB)\n", file.c_str(), static_cast<double>(bytes) / (1024.0 * 1024.0));
+  report("MactenToken", bytes, scan<MactenToken>(buffer, runs));
+  report("MactenAllToken", bytes, scan<MactenAllToken>(buffer, runs));
+ }
+
+ return 0;
+}
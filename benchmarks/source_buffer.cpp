@@ -0,0 +1,132 @@
+/**
+ * Benchmark of source ingestion: reading a file through ifstream/stringstream/string, as the
+ * scanner used to, against scanning it straight out of memory-mapped pages, and against scanning
+ * it through the bounded window `macten run` streams its input with (Scanner::open_stream).
+ *
+ * Each mode runs in its own child process, so peak RSS is that of the mode alone. It reports the
+ * time until the first token is scanned, the time to scan the whole file and the peak RSS.
+ * Mapped pages which have been touched count towards RSS, so after a full scan the mapped file
+ * is included in the peak.
+ *
+ * With --long-token=<MB>, the file is a single line holding one identifier of that many MB,
+ * which the window has to carry over from one chunk to the next until it ends.
+ *
+ * Build: g++ -std=c++20 -O2 source_buffer.cpp -o source_buffer
+ * Usage: ./source_buffer <file>
+ *        ./source_buffer --long-token=<MB>
+ */
+
+#include <chrono>
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+
+#include "../src/macten_all_tokens.hpp"
+
+using Clock = std::chrono::steady_clock;
+
+auto milliseconds(Clock::time_point from, Clock::time_point to) -> double
+{
+ return std::chrono::duration<double, std::milli>(to - from).count();
+}
+
+enum class Mode { Stream, Mapped, Window };
+
+auto run(const std::string& path, Mode mode) -> void
+{
+ const auto start = Clock::now();
+
+ MactenAllTokenScanner scanner{};
+ if (mode == Mode::Mapped)
+ {
+  if (!scanner.read_source(path)) std::exit(1);
+ }
+ else if (mode == Mode::Window)
+ {
+  // The chunk size of LazyTokenStream::from_file.
+  if (!scanner.open_stream(path, std::size_t{1} << 16)) std::exit(1);
+ }
+ else
+ {
+  std::ifstream ifs(path, std::ios::binary);
+  if (ifs.fail()) std::exit(1);
+  std::stringstream ss;
+  ss << ifs.rdbuf();
+  scanner.set_buffer(cpp20scanner::SourceBuffer::from_string(ss.str()));
+ }
+
+ auto token = scanner.scan_token();
+ const auto first = Clock::now();
+
+ std::size_t count {1};
+ while (token.type != MactenAllToken::EndOfFile)
+ {
+  token = scanner.scan_token();
+  count++;
+ }
+ const auto done = Clock::now();
+
+ rusage usage{};
+ getrusage(RUSAGE_SELF, &usage);
+
+ std::printf("%-8s first token %9.3f ms, full scan %9.1f ms, %zu tokens, peak RSS %7.1f MB\n",
+  mode == Mode::Mapped ? "mmap" : mode == Mode::Window ? "window" : "stream",
+  milliseconds(start, first),
+  milliseconds(start, done),
+  count,
+  static_cast<double>(usage.ru_maxrss) / 1024.0);
+}
+
+auto main(int argc, char* argv[]) -> int
+{
+ if (argc < 2)
+ {
+  std::cerr << "Usage: source_buffer <file> | --long-token=<MB>" << '\n';
+  return 1;
+ }
+
+ std::string path {argv[1]};
+ bool        generated {false};
+ if (path.starts_with("--long-token="))
+ {
+  const auto megabytes = std::stod(path.substr(13));
+  path                 = (std::filesystem::temp_directory_path() / "macten_long_token.txt").string();
+  generated            = true;
+
+  std::ofstream file(path, std::ios::binary);
+  file << "x = " << std::string(static_cast<std::size_t>(megabytes * 1024 * 1024), 'a') << '\n';
+  std::printf("one identifier of %.1f MB\n", megabytes);
+ }
+
+ int result {0};
+ for (const auto mode : {Mode::Stream, Mode::Mapped, Mode::Window})
+ {
+  std::fflush(stdout);
+  const auto pid = fork();
+  if (pid == 0)
+  {
+   run(path, mode);
+   std::fflush(stdout);
+   _exit(0);
+  }
+
+  int status {0};
+  waitpid(pid, &status, 0);
+  if (!WIFEXITED(status) || WEXITSTATUS(status) != 0)
+  {
+   std::cerr << "Failed to read '" << path << "'" << '\n';
+   result = 1;
+   break;
+  }
+ }
+
+ if (generated) std::filesystem::remove(path);
+ return result;
+}
@@ -0,0 +1,105 @@
+"""
+Benchmark of declarative macro substitution, in expansions per second.
+
+Writes one of three inputs, runs `macten run` on it and prints the best wall time of a few runs,
+and the number of macro expansions per second it amounts to:
+
+  body   `lines` calls of a macro with a 100-token body, and `lines` calls of a macro whose body
+         calls it, so 3 * `lines` expansions
+  calls  `lines` lines of three calls of small macros, 3 * `lines` expansions
+  nest   `lines` lines of calls nested 6 levels deep, 6 * `lines` expansions
+
+Every call takes the line number as an argument, so no two calls expand the same.
+
+Usage: python3 substitution.py <macten executable> <body|calls|nest> [lines] [runs]
+"""
+
+import os
+import subprocess
+import sys
+import tempfile
+import time
+
+BODY_DEFINITIONS = """defmacten_dec big {
+  ($a, $b) => {
+    check($a, $b); total = $a + $b * 2 - ($a * $b) / 3; values[$a] = [$b, $a, $b, $a];
+    log("big", $a, $b, total); result = min($a, max($b, total)) + offset[$b] - scale[$a];
+  }
+}
+
+defmacten_dec outer {
+  ($a) => {big![$a, 1]}
+}
+
+"""
+
+CALLS_DEFINITIONS = """defmacten_dec add {
+  ($a, $b) => {($a + $b)}
+}
+
+defmacten_dec neg {
+  ($a) => {(-$a)}
+}
+
+defmacten_dec pick {
+  ($a, $b, $c) => {[$c, $b, $a]}
+}
+
+"""
+
+NEST_DEFINITIONS = """defmacten_dec wrap {
+  ($a) => {w($a)}
+}
+
+"""
+
+
+def write_input(path: str, kind: str, lines: int) -> int:
+    """
+    Write the input, and return the number of expansions it makes.
+    """
+    with open(path, "w") as source:
+        if kind == "body":
+            source.write(BODY_DEFINITIONS)
+            for line in range(lines):
+                source.write(f"big![{line}, 2]\nouter![{line}]\n")
+            return 3 * lines
+
+        if kind == "calls":
+            source.write(CALLS_DEFINITIONS)
+            for line in range(lines):
+                source.write(f"a{line} = add![{line}, 1] + neg![{line}] + pick![{line}, 2, 3]\n")
+            return 3 * lines
+
+        source.write(NEST_DEFINITIONS)
+        for line in range(lines):
+            source.write(f"a{line} = " + "wrap![(" * 6 + f"x{line}" + ")]" * 6 + "\n")
+        return 6 * lines
+
+
+def main() -> None:
+    if len(sys.argv) < 3 or sys.argv[2] not in ("body", "calls", "nest"):
+        print(__doc__.strip())
+        sys.exit(1)
+
+    executable = sys.argv[1]
+    kind = sys.argv[2]
+    lines = int(sys.argv[3]) if len(sys.argv) > 3 else {"body": 20000, "calls": 32000, "nest": 10000}[kind]
+    runs = int(sys.argv[4]) if len(sys.argv) > 4 else 9
+
+    with tempfile.TemporaryDirectory() as directory:
+        source = os.path.join(directory, f"{kind}.py")
+        output = os.path.join(directory, f"{kind}.macten.py")
+        expansions = write_input(source, kind, lines)
+
+        best = float("inf")
+        for _ in range(runs):
+            start = time.perf_counter()
+            subprocess.run([executable, "run", source, output], check=True, capture_output=True)
+            best = min(best, time.perf_counter() - start)
+
+    print(f"{kind}, {expansions} expansions: {best * 1000:.1f} ms, {expansions / best / 1000:.0f}k expansions/s")
+
+
+if __name__ == "__main__":
+    main()
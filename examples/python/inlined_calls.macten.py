@@ -0,0 +1,4 @@
+square = [Point(x=0, y=0), Point(x=1, y=2), Point(x=square, y=square), 1 + 2 + 3]
+start = Point(x=0, y=0)
+moved = Point(x=3, y=3)
+total = 4 + 5 + 6 + 7
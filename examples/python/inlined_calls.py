@@ -0,0 +1,25 @@
+defmacten_dec point {
+  ($x, $y) => {Point(x=$x, y=$y)}
+}
+
+defmacten_dec origin {
+  () => {point![0, 0]}
+}
+
+defmacten_dec shifted {
+  ($d) => {point![$d, $d]}
+}
+
+defmacten_dec sum {
+  ($x, $($y,)) => {$x + sum![$y]}
+  ($x,) => {$x}
+}
+
+defmacten_dec shape {
+  ($name) => {$name = [origin![], point![1, 2], shifted![$name], sum![1, 2, 3,]]}
+}
+
+shape![square]
+start = origin![]
+moved = shifted![3]
+total = sum![4, 5, 6, 7,]
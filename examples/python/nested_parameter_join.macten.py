@@ -0,0 +1,4 @@
+z = abcd
+n = ab12
+u = x_y
+p = get_value
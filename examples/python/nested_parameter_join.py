@@ -0,0 +1,16 @@
+defmacten_dec id {
+  ($x) => {$x}
+}
+
+defmacten_dec glue {
+  ($a, $b) => {id![$a$b]}
+}
+
+defmacten_dec prefix {
+  ($a) => {id![get_$a]}
+}
+
+z = glue![ab, cd]
+n = glue![ab, 12]
+u = glue![x, (_y)]
+p = prefix![value]
@@ -42,8 +42,31 @@
 #include <iostream>
 #include <sstream>
 #include <algorithm>
+#include <fstream>
+#include <array>
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
 #include <string_view>
 #include <tuple>
+#include <vector>
+
+#if defined(__unix__) || defined(__APPLE__)
+#define CPP20SCANNER_HAS_MMAP
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+
+// Vectorized byte classification. Define CPP20SCANNER_NO_SIMD to force the scalar path.
+#if !defined(CPP20SCANNER_NO_SIMD) && defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define CPP20SCANNER_HAS_SIMD
+#include <immintrin.h>
+#endif
 
 namespace cpp20scanner
 {
@@ -542,6 +565,669 @@ cpp20scanner::TokenBase<enum_class_name>::BaseEnumType::name,
 
 #endif /* TOKEN_BASE_CLASS */
 
+#ifndef BYTE_CLASSIFY_H
+#define BYTE_CLASSIFY_H
+
+/**
+ * Byte classification used by the scanner to consume whole runs of identifier characters,
+ * digits and whitespace in one step.
+ *
+ * Every byte is classified with a single load from a constexpr 256-entry table. Scanners extend
+ * the base table with the classes from their token descriptor file (see char_classes in the
+ * generated scanner).
+ *
+ * Each run function returns the position of the first byte at or after `pos` which is not part
+ * of the run. Classification is ASCII only, so the result does not depend on the locale. On x86
+ * an SSE2 or AVX2 kernel is picked at runtime; the scalar kernels produce identical results and
+ * are used for the tail of the input and on other targets.
+ */
+namespace classify
+{
+    /**
+     * Class bits of a byte.
+     */
+    enum Class : std::uint8_t
+    {
+        Digit      = 1 << 0,
+        Alpha      = 1 << 1,
+        Identifier = 1 << 2, // [A-Za-z0-9_]
+        Ignore     = 1 << 3, // IGNORE_TOKEN
+        Symbol     = 1 << 4, // SYMBOL_TOKEN
+    };
+
+    using ClassTable = std::array<std::uint8_t, 256>;
+
+    /**
+     * The locale independent base classes.
+     */
+    inline constexpr ClassTable ascii_classes = [] {
+        ClassTable table{};
+        for (int c{'0'}; c <= '9'; c++) table[c] |= Digit | Identifier;
+        for (int c{'a'}; c <= 'z'; c++) table[c] |= Alpha | Identifier;
+        for (int c{'A'}; c <= 'Z'; c++) table[c] |= Alpha | Identifier;
+        table['_'] |= Identifier;
+        return table;
+    }();
+
+    [[nodiscard]] constexpr auto is(const ClassTable& table, char c, std::uint8_t mask) noexcept -> bool
+    {
+        return (table[static_cast<unsigned char>(c)] & mask) != 0;
+    }
+
+    [[nodiscard]] constexpr auto is_digit(char c) noexcept -> bool
+    {
+        return is(ascii_classes, c, Digit);
+    }
+
+    [[nodiscard]] constexpr auto is_alpha(char c) noexcept -> bool
+    {
+        return is(ascii_classes, c, Alpha);
+    }
+
+    [[nodiscard]] constexpr auto is_identifier(char c) noexcept -> bool
+    {
+        return is(ascii_classes, c, Identifier);
+    }
+
+    /**
+     * The bytes of a table which carry the given class. Holds both the membership table, for the
+     * scalar kernels, and the list of members, for the vector kernels.
+     */
+    struct ByteSet
+    {
+        constexpr ByteSet(const ClassTable& table, std::uint8_t mask) noexcept
+        {
+            for (std::size_t c{0}; c < table.size(); c++)
+            {
+                if ((table[c] & mask) == 0) continue;
+                member[c]      = true;
+                bytes[size++]  = static_cast<char>(c);
+            }
+        }
+
+        [[nodiscard]] constexpr auto contains(char c) const noexcept -> bool
+        {
+            return member[static_cast<unsigned char>(c)];
+        }
+
+        [[nodiscard]] constexpr auto members() const noexcept -> std::string_view
+        {
+            return {bytes.data(), size};
+        }
+
+        std::array<bool, 256> member{};
+        std::array<char, 256> bytes{};
+        std::size_t           size{0};
+    };
+
+    namespace detail
+    {
+        inline auto scalar_identifier_run(std::string_view src, std::size_t pos) noexcept -> std::size_t
+        {
+            while (pos < src.size() && is_identifier(src[pos])) ++pos;
+            return pos;
+        }
+
+        inline auto scalar_digit_run(std::string_view src, std::size_t pos) noexcept -> std::size_t
+        {
+            while (pos < src.size() && is_digit(src[pos])) ++pos;
+            return pos;
+        }
+
+        inline auto scalar_set_run(std::string_view src, std::size_t pos, const ByteSet& set) noexcept -> std::size_t
+        {
+            while (pos < src.size() && set.contains(src[pos])) ++pos;
+            return pos;
+        }
+
+#ifdef CPP20SCANNER_HAS_SIMD
+        __attribute__((target("sse2")))
+        inline auto sse2_range_mask(__m128i v, char lo, char hi) noexcept -> __m128i
+        {
+            return _mm_and_si128(_mm_cmpgt_epi8(v, _mm_set1_epi8(static_cast<char>(lo - 1))),
+                                 _mm_cmplt_epi8(v, _mm_set1_epi8(static_cast<char>(hi + 1))));
+        }
+
+        __attribute__((target("sse2")))
+        inline auto sse2_identifier_mask(__m128i v) noexcept -> unsigned
+        {
+            const auto lower = _mm_or_si128(v, _mm_set1_epi8(0x20));
+            const auto m     = _mm_or_si128(_mm_or_si128(sse2_range_mask(lower, 'a', 'z'),
+                                                         sse2_range_mask(v, '0', '9')),
+                                            _mm_cmpeq_epi8(v, _mm_set1_epi8('_')));
+            return static_cast<unsigned>(_mm_movemask_epi8(m));
+        }
+
+        __attribute__((target("sse2")))
+        inline auto sse2_identifier_run(std::string_view src, std::size_t pos) noexcept -> std::size_t
+        {
+            while (pos + 16 <= src.size())
+            {
+                const auto v    = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src.data() + pos));
+                const auto miss = ~sse2_identifier_mask(v) & 0xFFFFu;
+                if (miss != 0) return pos + __builtin_ctz(miss);
+                pos += 16;
+            }
+            return scalar_identifier_run(src, pos);
+        }
+
+        __attribute__((target("sse2")))
+        inline auto sse2_digit_run(std::string_view src, std::size_t pos) noexcept -> std::size_t
+        {
+            while (pos + 16 <= src.size())
+            {
+                const auto v    = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src.data() + pos));
+                const auto hit  = static_cast<unsigned>(_mm_movemask_epi8(sse2_range_mask(v, '0', '9')));
+                const auto miss = ~hit & 0xFFFFu;
+                if (miss != 0) return pos + __builtin_ctz(miss);
+                pos += 16;
+            }
+            return scalar_digit_run(src, pos);
+        }
+
+        __attribute__((target("sse2")))
+        inline auto sse2_set_run(std::string_view src, std::size_t pos, const ByteSet& set) noexcept -> std::size_t
+        {
+            while (pos + 16 <= src.size())
+            {
+                const auto v = _mm_loadu_si128(reinterpret_cast<const __m128i*>(src.data() + pos));
+                auto       m = _mm_setzero_si128();
+                for (const char c : set.members()) m = _mm_or_si128(m, _mm_cmpeq_epi8(v, _mm_set1_epi8(c)));
+                const auto miss = ~static_cast<unsigned>(_mm_movemask_epi8(m)) & 0xFFFFu;
+                if (miss != 0) return pos + __builtin_ctz(miss);
+                pos += 16;
+            }
+            return scalar_set_run(src, pos, set);
+        }
+
+        __attribute__((target("avx2")))
+        inline auto avx2_range_mask(__m256i v, char lo, char hi) noexcept -> __m256i
+        {
+            return _mm256_and_si256(_mm256_cmpgt_epi8(v, _mm256_set1_epi8(static_cast<char>(lo - 1))),
+                                    _mm256_cmpgt_epi8(_mm256_set1_epi8(static_cast<char>(hi + 1)), v));
+        }
+
+        __attribute__((target("avx2")))
+        inline auto avx2_identifier_run(std::string_view src, std::size_t pos) noexcept -> std::size_t
+        {
+            while (pos + 32 <= src.size())
+            {
+                const auto v     = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src.data() + pos));
+                const auto lower = _mm256_or_si256(v, _mm256_set1_epi8(0x20));
+                const auto m     = _mm256_or_si256(_mm256_or_si256(avx2_range_mask(lower, 'a', 'z'),
+                                                                   avx2_range_mask(v, '0', '9')),
+                                                   _mm256_cmpeq_epi8(v, _mm256_set1_epi8('_')));
+                const auto miss  = ~static_cast<unsigned>(_mm256_movemask_epi8(m));
+                if (miss != 0) return pos + __builtin_ctz(miss);
+                pos += 32;
+            }
+            return sse2_identifier_run(src, pos);
+        }
+
+        __attribute__((target("avx2")))
+        inline auto avx2_digit_run(std::string_view src, std::size_t pos) noexcept -> std::size_t
+        {
+            while (pos + 32 <= src.size())
+            {
+                const auto v    = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src.data() + pos));
+                const auto miss = ~static_cast<unsigned>(_mm256_movemask_epi8(avx2_range_mask(v, '0', '9')));
+                if (miss != 0) return pos + __builtin_ctz(miss);
+                pos += 32;
+            }
+            return sse2_digit_run(src, pos);
+        }
+
+        __attribute__((target("avx2")))
+        inline auto avx2_set_run(std::string_view src, std::size_t pos, const ByteSet& set) noexcept -> std::size_t
+        {
+            while (pos + 32 <= src.size())
+            {
+                const auto v = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(src.data() + pos));
+                auto       m = _mm256_setzero_si256();
+                for (const char c : set.members()) m = _mm256_or_si256(m, _mm256_cmpeq_epi8(v, _mm256_set1_epi8(c)));
+                const auto miss = ~static_cast<unsigned>(_mm256_movemask_epi8(m));
+                if (miss != 0) return pos + __builtin_ctz(miss);
+                pos += 32;
+            }
+            return sse2_set_run(src, pos, set);
+        }
+#endif /* CPP20SCANNER_HAS_SIMD */
+
+        /**
+         * The set of kernels in use, picked once on first use.
+         */
+        struct Kernels
+        {
+            std::size_t (*identifier_run)(std::string_view, std::size_t) noexcept;
+            std::size_t (*digit_run)(std::string_view, std::size_t) noexcept;
+            std::size_t (*set_run)(std::string_view, std::size_t, const ByteSet&) noexcept;
+        };
+
+        inline auto select_kernels() noexcept -> Kernels
+        {
+#ifdef CPP20SCANNER_HAS_SIMD
+            __builtin_cpu_init();
+            if (__builtin_cpu_supports("avx2"))
+                return {avx2_identifier_run, avx2_digit_run, avx2_set_run};
+            if (__builtin_cpu_supports("sse2"))
+                return {sse2_identifier_run, sse2_digit_run, sse2_set_run};
+#endif
+            return {scalar_identifier_run, scalar_digit_run, scalar_set_run};
+        }
+
+        inline auto kernels() noexcept -> const Kernels&
+        {
+            static const Kernels selected = select_kernels();
+            return selected;
+        }
+    } // namespace detail
+
+    /**
+     * Skip over identifier characters ([A-Za-z0-9_]).
+     */
+    [[nodiscard]] inline auto identifier_run(std::string_view src, std::size_t pos) noexcept -> std::size_t
+    {
+        return detail::kernels().identifier_run(src, pos);
+    }
+
+    /**
+     * Skip over decimal digits.
+     */
+    [[nodiscard]] inline auto digit_run(std::string_view src, std::size_t pos) noexcept -> std::size_t
+    {
+        return detail::kernels().digit_run(src, pos);
+    }
+
+    /**
+     * Skip over any of the bytes in `set`.
+     */
+    [[nodiscard]] inline auto set_run(std::string_view src, std::size_t pos, const ByteSet& set) noexcept -> std::size_t
+    {
+        if (set.size == 0) return pos;
+        return detail::kernels().set_run(src, pos, set);
+    }
+} // namespace classify
+
+#endif /* BYTE_CLASSIFY_H */
+
+#ifndef KEYWORD_TABLE_H
+#define KEYWORD_TABLE_H
+
+/**
+ * A keyword and the token type it maps to. An entry with an empty keyword is ignored, which
+ * lets generated entry lists end with a sentinel.
+ */
+template <typename TokenType>
+struct KeywordEntry
+{
+    std::string_view keyword{};
+    TokenType        type{};
+};
+
+/**
+ * Compile-time perfect hash over a fixed set of keywords.
+ *
+ * Lookups first reject words whose length or first byte no keyword has, so most identifiers
+ * are turned away after two bit tests. Lengths of 63 bytes and more share one bit of the length
+ * filter. Survivors are hashed into a collision free table (the multiplier is searched for at
+ * compile time) and compared against the one candidate keyword.
+ *
+ * The hash only sees the first byte, last byte and length of a word. If no multiplier below
+ * `multiplier_limit` separates the keywords (e.g. two of them agree on all three), the table is
+ * not perfect and lookups compare the word against every keyword instead.
+ */
+template <typename TokenType, std::size_t N>
+class KeywordTable
+{
+    static constexpr std::size_t slot_count = [] {
+        std::size_t count = 1;
+        while (count < N * 2) count *= 2;
+        return count;
+    }();
+
+    static constexpr std::uint32_t multiplier_limit = 1 << 13;
+
+  public:
+    constexpr explicit KeywordTable(const KeywordEntry<TokenType> (&entries)[N])
+    {
+        for (std::size_t i{0}; i < N; i++)
+        {
+            const auto keyword = entries[i].keyword;
+            if (keyword.empty()) continue;
+            m_lengths |= length_bit(keyword.size());
+            const auto first = static_cast<unsigned char>(keyword.front());
+            m_first_bytes[first / 64] |= std::uint64_t{1} << (first % 64);
+        }
+
+        // Find a multiplier under which no two keywords share a slot.
+        for (std::uint32_t multiplier{1}; multiplier < multiplier_limit && !m_perfect; multiplier += 2)
+        {
+            m_multiplier = multiplier;
+            m_perfect    = true;
+            m_slots.fill(-1);
+            for (std::size_t i{0}; i < N && m_perfect; i++)
+            {
+                if (entries[i].keyword.empty()) continue;
+                auto& slot = m_slots[slot_of(entries[i].keyword)];
+                m_perfect  = slot == -1;
+                slot       = static_cast<std::int16_t>(i);
+            }
+        }
+
+        for (std::size_t i{0}; i < N; i++) m_entries[i] = entries[i];
+    }
+
+    /**
+     * Returns the token type of the keyword, if the word is one.
+     */
+    [[nodiscard]] constexpr auto find(std::string_view word) const noexcept -> std::optional<TokenType>
+    {
+        if (word.empty() || (m_lengths & length_bit(word.size())) == 0)
+            return {};
+
+        const auto first = static_cast<unsigned char>(word.front());
+        if ((m_first_bytes[first / 64] & (std::uint64_t{1} << (first % 64))) == 0)
+            return {};
+
+        if (!m_perfect)
+        {
+            for (const auto& entry : m_entries)
+                if (!entry.keyword.empty() && entry.keyword == word) return entry.type;
+            return {};
+        }
+
+        const auto index = m_slots[slot_of(word)];
+        if (index == -1 || m_entries[index].keyword != word)
+            return {};
+
+        return m_entries[index].type;
+    }
+
+    /**
+     * Returns true if a collision free multiplier was found, i.e. lookups take a single probe.
+     */
+    [[nodiscard]] constexpr auto is_perfect() const noexcept -> bool
+    {
+        return m_perfect;
+    }
+
+  private:
+    [[nodiscard]] static constexpr auto length_bit(std::size_t size) noexcept -> std::uint64_t
+    {
+        return std::uint64_t{1} << std::min<std::size_t>(size, 63);
+    }
+
+    [[nodiscard]] constexpr auto slot_of(std::string_view word) const noexcept -> std::size_t
+    {
+        const std::uint32_t key = static_cast<unsigned char>(word.front())
+                                | static_cast<std::uint32_t>(static_cast<unsigned char>(word.back())) << 8
+                                | static_cast<std::uint32_t>(word.size()) << 16;
+        return static_cast<std::size_t>((key * m_multiplier) >> 16) & (slot_count - 1);
+    }
+
+    /**
+     * Members.
+     */
+    std::uint64_t                           m_lengths{0};
+    std::array<std::uint64_t, 4>            m_first_bytes{};
+    std::uint32_t                           m_multiplier{1};
+    bool                                    m_perfect{false};
+    std::array<std::int16_t, slot_count>    m_slots{};
+    std::array<KeywordEntry<TokenType>, N>  m_entries{};
+};
+
+#endif /* KEYWORD_TABLE_H */
+
+#ifndef SOURCE_BUFFER_H
+#define SOURCE_BUFFER_H
+
+/**
+ * A position inside a source buffer. Both line and column are 1-based, columns count bytes.
+ */
+struct SourceLocation
+{
+    std::size_t line{0};
+    std::size_t column{0};
+};
+
+/**
+ * The bytes a scanner reads from.
+ *
+ * Regular files are memory mapped and scanned straight out of the mapped pages. Anything
+ * which cannot be mapped (pipes, character devices, empty files, non-POSIX platforms)
+ * falls back to being read into an owned string.
+ *
+ * The buffer never moves once loaded, so views into it stay valid for as long as the
+ * buffer itself is alive. Buffers are always handed out as shared pointers so that
+ * anything holding a view (see Token) can pin the buffer it points into.
+ */
+class SourceBuffer : public std::enable_shared_from_this<SourceBuffer>
+{
+  public:
+    SourceBuffer() = default;
+
+    SourceBuffer(const SourceBuffer&)                    = delete;
+    auto operator=(const SourceBuffer&) -> SourceBuffer& = delete;
+
+    ~SourceBuffer()
+    {
+        unmap();
+    }
+
+    /**
+     * Construct a buffer which owns a copy of the given source.
+     */
+    [[nodiscard]] static auto from_string(std::string source, SourceLocation origin = {1, 1})
+        -> std::shared_ptr<SourceBuffer>
+    {
+        auto buffer      = std::make_shared<SourceBuffer>();
+        buffer->m_owned  = std::move(source);
+        buffer->m_view   = buffer->m_owned;
+        buffer->m_origin = origin;
+        return buffer;
+    }
+
+    /**
+     * Construct a buffer holding the content of the file at the given path. Returns nullptr
+     * if the file could not be opened.
+     */
+    [[nodiscard]] static auto from_file(const std::string& path) -> std::shared_ptr<SourceBuffer>
+    {
+        auto buffer = std::make_shared<SourceBuffer>();
+        if (buffer->map_file(path))
+            return buffer;
+
+        std::ifstream ifs(path, std::ios::binary);
+        if (ifs.fail())
+            return nullptr;
+
+        std::stringstream ss;
+        ss << ifs.rdbuf();
+        buffer->m_owned = std::move(ss).str();
+        buffer->m_view  = buffer->m_owned;
+        return buffer;
+    }
+
+    /**
+     * Returns the source content.
+     */
+    [[nodiscard]] auto view() const noexcept -> std::string_view
+    {
+        return m_view;
+    }
+
+    /**
+     * Returns the byte offset of a slice of this buffer.
+     */
+    [[nodiscard]] auto offset_of(std::string_view slice) const noexcept -> std::size_t
+    {
+        return static_cast<std::size_t>(slice.data() - m_view.data());
+    }
+
+    /**
+     * Returns the line and column of the given byte offset. The line index is built on the
+     * first call, in one pass over the buffer. Buffers holding a window of a larger input
+     * report locations relative to that input (see `origin` in from_string).
+     */
+    [[nodiscard]] auto location(std::size_t offset) const -> SourceLocation
+    {
+        std::call_once(m_line_index_once, [this] { build_line_index(); });
+
+        // The last line starting at or before the offset.
+        const auto it     = std::upper_bound(m_line_starts.begin(), m_line_starts.end(), offset);
+        const auto line   = static_cast<std::size_t>(it - m_line_starts.begin());
+        const auto column = offset - m_line_starts[line - 1] + 1;
+
+        if (line == 1)
+            return {m_origin.line, m_origin.column + column - 1};
+        return {m_origin.line + line - 1, column};
+    }
+
+    /**
+     * Returns true when the content is served from mapped pages.
+     */
+    [[nodiscard]] auto is_mapped() const noexcept -> bool
+    {
+        return m_mapped != nullptr;
+    }
+
+  private:
+    /**
+     * Try mapping the file at the given path. Returns false if the file is not a regular,
+     * non-empty file or the mapping fails, in which case the caller is expected to fall back
+     * to reading the file.
+     */
+    auto map_file(const std::string& path) noexcept -> bool
+    {
+#ifdef CPP20SCANNER_HAS_MMAP
+        const int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0)
+            return false;
+
+        struct stat st{};
+        if (::fstat(fd, &st) != 0 || !S_ISREG(st.st_mode) || st.st_size <= 0)
+        {
+            ::close(fd);
+            return false;
+        }
+
+        const auto size = static_cast<std::size_t>(st.st_size);
+        void*      addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd, 0);
+
+        // The mapping keeps its own reference to the file.
+        ::close(fd);
+
+        if (addr == MAP_FAILED)
+            return false;
+
+        ::madvise(addr, size, MADV_SEQUENTIAL);
+
+        m_mapped      = addr;
+        m_mapped_size = size;
+        m_view        = std::string_view(static_cast<const char*>(addr), size);
+        return true;
+#else
+        return false;
+#endif
+    }
+
+    /**
+     * Record the offset at which every line starts.
+     */
+    auto build_line_index() const -> void
+    {
+        m_line_starts.push_back(0);
+
+        const char* const begin = m_view.data();
+        const char* const end   = begin + m_view.size();
+        const char*       it    = begin;
+        while (it != end)
+        {
+            const auto* nl = static_cast<const char*>(std::memchr(it, '\n', static_cast<std::size_t>(end - it)));
+            if (nl == nullptr) break;
+            it = nl + 1;
+            m_line_starts.push_back(static_cast<std::size_t>(it - begin));
+        }
+    }
+
+    auto unmap() noexcept -> void
+    {
+#ifdef CPP20SCANNER_HAS_MMAP
+        if (m_mapped != nullptr)
+            ::munmap(m_mapped, m_mapped_size);
+#endif
+        m_mapped      = nullptr;
+        m_mapped_size = 0;
+    }
+
+    /**
+     * Members.
+     */
+    void*            m_mapped{nullptr};
+    std::size_t      m_mapped_size{0};
+    std::string      m_owned{};
+    std::string_view m_view{};
+    SourceLocation   m_origin{1, 1};
+
+    // Built lazily by location().
+    mutable std::once_flag           m_line_index_once{};
+    mutable std::vector<std::size_t> m_line_starts{};
+};
+
+/**
+ * Reads a file (or pipe) in fixed size chunks, for inputs which should not be loaded whole.
+ */
+class ChunkReader
+{
+  public:
+    ChunkReader(const std::string& path, std::size_t chunk_size)
+        : m_stream(path, std::ios::binary)
+        , m_chunk_size(chunk_size == 0 ? 1 : chunk_size)
+    {
+        m_exhausted = !m_stream.is_open();
+    }
+
+    [[nodiscard]] auto is_open() const noexcept -> bool
+    {
+        return m_stream.is_open();
+    }
+
+    /**
+     * Returns true once every byte of the input has been read.
+     */
+    [[nodiscard]] auto exhausted() const noexcept -> bool
+    {
+        return m_exhausted;
+    }
+
+    /**
+     * Append the next chunk to `into`, or the next `at_least` bytes if that is more than a chunk.
+     * Returns false if there was nothing left to read.
+     */
+    auto read_into(std::string& into, std::size_t at_least = 0) -> bool
+    {
+        if (m_exhausted)
+            return false;
+
+        const auto size     = std::max(m_chunk_size, at_least);
+        const auto old_size = into.size();
+        into.resize(old_size + size);
+        m_stream.read(into.data() + old_size, static_cast<std::streamsize>(size));
+        const auto count = static_cast<std::size_t>(m_stream.gcount());
+        into.resize(old_size + count);
+
+        m_exhausted = !m_stream || m_stream.peek() == std::ifstream::traits_type::eof();
+        return count > 0;
+    }
+
+  private:
+    std::ifstream m_stream;
+    std::size_t   m_chunk_size;
+    bool          m_exhausted{false};
+};
+
+#endif /* SOURCE_BUFFER_H */
+
 #ifndef TOKEN_H
 #define TOKEN_H
 
@@ -549,6 +1235,14 @@ cpp20scanner::TokenBase<enum_class_name>::BaseEnumType::name,
 
 /**
  * A basic token. Used to classify text.
+ *
+ * The lexeme does not own its characters, it is a view into the SourceBuffer the token
+ * was scanned from (or synthesized into). `source` names that buffer without owning it;
+ * whoever stores tokens is responsible for keeping their buffers alive; TokenStream does
+ * this by pinning the source of every token pushed into it.
+ *
+ * Tokens do not store their position, line and column are derived from the lexeme's offset
+ * into its source buffer when needed.
  */
 template<typename TokenType>
 struct Token
@@ -560,10 +1254,10 @@ struct Token
     /**
      * Constructor.
      */
-    [[nodiscard]] Token(TokenType t, std::string_view l, std::size_t line_num) noexcept
+    [[nodiscard]] Token(TokenType t, std::string_view l, const SourceBuffer* src = nullptr) noexcept
         : type{t}
         , lexeme{l}
-        , line{line_num}
+        , source{src}
     {
     }
 
@@ -572,13 +1266,39 @@ struct Token
      */
     [[nodiscard]] Token() noexcept
         : type{TokenType::EndOfFile}
-        , lexeme{"\0"}
+        , lexeme{}
     {
     }
 
+    /**
+     * Make a token which is not backed by a source buffer. The caller is
+     * expected to keep the lexeme alive (e.g. a string literal).
+     */
     [[nodiscard]] static auto make(TokenType t, std::string_view l) -> Token<TokenType>
     {
-        return Token(t, l, 0);
+        return Token(t, l);
+    }
+
+    /**
+     * Returns the byte offset of the token in its source buffer.
+     */
+    [[nodiscard]] auto offset() const noexcept -> std::size_t
+    {
+        return source == nullptr ? 0 : source->offset_of(lexeme);
+    }
+
+    /**
+     * Returns the line and column of the token in its source buffer. Tokens without a source
+     * are reported at line 0.
+     */
+    [[nodiscard]] auto location() const -> SourceLocation
+    {
+        return source == nullptr ? SourceLocation{} : source->location(offset());
+    }
+
+    [[nodiscard]] auto line() const -> std::size_t
+    {
+        return location().line;
     }
 
     [[nodiscard]] auto is(TokenType t) const noexcept -> bool
@@ -600,9 +1320,9 @@ struct Token
     /**
      * MEMBERS.
      */
-    TokenType   type{};
-    std::string lexeme{};
-    std::size_t line{};
+    TokenType           type{};
+    std::string_view    lexeme{};
+    const SourceBuffer* source{nullptr};
 };
 
 
@@ -739,7 +1459,7 @@ class BaseParser
      */
     auto report_token_error(Token<TokenType> token) noexcept -> void
     {
-        auto message = "Unexpected token '" + token.lexeme + "'.";
+        auto message = "Unexpected token '" + std::string(token.lexeme) + "'.";
         report_error(message);
     }
 
@@ -754,7 +1474,8 @@ class BaseParser
 
         this->panic = true;
 
-        std::cout << "ERROR [ (line:" << previous.line << ") " << message << " ]\n";
+        const auto location = previous.location();
+        std::cerr << "ERROR [ (line:" << location.line << ", col:" << location.column << ") " << message << " ]\n";
 
         this->has_error = true;
     }
@@ -765,7 +1486,7 @@ class BaseParser
     auto log(std::string_view message) const noexcept -> void
     {
 #ifdef DEBUG
-        std::cout << "LOG [ " << message << " ]\n";
+        std::cerr << "LOG [ " << message << " ]\n";
 #else
 #endif
     }
@@ -1082,40 +1803,82 @@ struct SCANNER(TOKEN_CLASS_NAME)
     SCANNER(TOKEN_CLASS_NAME)() = default;
 
 
-    /**
-     * Convert string to token.
-     */
-    static auto strtok(const std::string& str) -> cpp20scanner::Token<TOKEN_CLASS_NAME>
+    void set_source(std::string_view source)
     {
-        SCANNER(TOKEN_CLASS_NAME) scanner {};
-        scanner.set_source(str);
-        return scanner.scan_token();
+        set_buffer(cpp20scanner::SourceBuffer::from_string(std::string(source)));
     }
-    
 
-    void set_source(const std::string& source)
+    /**
+     * Scan the file at the given path in chunks of `chunk_size` bytes instead of loading it
+     * whole. Whenever a token, run of whitespace or comment reaches the end of the current
+     * window, the window is replaced by a new buffer holding its unfinished tail followed by the
+     * next chunk. Tokens already returned keep pointing into the window they were scanned from,
+     * but do not keep it alive: the scanner drops a window once it moves on, so tokens must be
+     * stored where their source is pinned, e.g. in a TokenStream or LazyTokenStream. Memory is
+     * bounded by whoever holds on to those.
+     *
+     * NOTE: Only token-at-a-time scanning (scan_token, scan_raw) is supported in this mode.
+     */
+    bool open_stream(const std::string& path, std::size_t chunk_size)
     {
-        reset();
-        source_code = source;
+        auto chunk_reader = std::make_shared<cpp20scanner::ChunkReader>(path, chunk_size);
+        set_buffer(cpp20scanner::SourceBuffer::from_string(""));
+        if (!chunk_reader->is_open())
+            return false;
+
+        this->reader = std::move(chunk_reader);
+        static_cast<void>(refill(0));
+        return true;
     }
 
     /**
-     * Read all the source code from the file.
+     * Read all the source code from the file. Regular files are memory mapped
+     * and scanned in place.
      */
     bool read_source(const std::string& path)
     {
-        reset();
+        auto buffer = cpp20scanner::SourceBuffer::from_file(path);
+        if (buffer == nullptr)
+        {
+            set_buffer(cpp20scanner::SourceBuffer::from_string(""));
+            return false;
+        }
 
-        this->source_code.clear();
+        set_buffer(std::move(buffer));
+        return true;
+    }
 
-        std::ifstream     ifs(path);
-        if (ifs.fail()) return false;
+    /**
+     * Returns the buffer the scanner reads from. Tokens produced by the
+     * scanner are views into it.
+     */
+    [[nodiscard]] auto buffer() const noexcept -> const std::shared_ptr<const cpp20scanner::SourceBuffer>&
+    {
+        return this->source_buffer;
+    }
 
-        std::stringstream buffer;
-        buffer << ifs.rdbuf();
-        this->source_code = buffer.str();
+    /**
+     * Scan from an already loaded source buffer.
+     */
+    void set_buffer(std::shared_ptr<const cpp20scanner::SourceBuffer> buffer)
+    {
+        reset();
+        this->reader        = nullptr;
+        this->source_buffer = std::move(buffer);
+        this->source_code   = this->source_buffer->view();
+    }
 
-        return true;
+    /**
+     * Scan only the bytes in [begin, end) of the buffer. Lexemes still point into the whole
+     * buffer, so token offsets and locations are those of the full source. The range should
+     * start at the beginning of a line, where no token or comment can be in progress.
+     */
+    void set_range(std::shared_ptr<const cpp20scanner::SourceBuffer> buffer, std::size_t begin, std::size_t end)
+    {
+        set_buffer(std::move(buffer));
+        this->source_code = this->source_code.substr(0, end);
+        this->start       = begin;
+        this->current     = begin;
     }
 
     /**
@@ -1123,7 +1886,9 @@ struct SCANNER(TOKEN_CLASS_NAME)
      */
     [[nodiscard]] cpp20scanner::Token<TOKEN_CLASS_NAME> scan_number() noexcept
     {
-        while (std::isdigit(peek())) advance_position();
+        current = cpp20scanner::classify::digit_run(source_code, current);
+        while (current == source_code.length() && refill(start))
+            current = cpp20scanner::classify::digit_run(source_code, current);
         return make_token(TOKEN_CLASS_NAME::Number);
     }
 
@@ -1132,7 +1897,9 @@ struct SCANNER(TOKEN_CLASS_NAME)
      */
     [[nodiscard]] cpp20scanner::Token<TOKEN_CLASS_NAME> scan_identifier() noexcept
     {
-        while (std::isalnum(peek()) || peek()=='_') advance_position();
+        current = cpp20scanner::classify::identifier_run(source_code, current);
+        while (current == source_code.length() && refill(start))
+            current = cpp20scanner::classify::identifier_run(source_code, current);
         return make_token(identifier_type());
     }
 
@@ -1140,13 +1907,17 @@ struct SCANNER(TOKEN_CLASS_NAME)
      * Return the identifer type. This could return as
      * one of the keyword types.
      */
-    [[nodiscard]] auto identifier_type() -> TOKEN_CLASS_NAME 
+    [[nodiscard]] auto identifier_type() const noexcept -> TOKEN_CLASS_NAME 
     {
         const auto word = source_code.substr(start, current-start);
-        
-        return MATCH(word)
-            return TOKEN_CLASS_NAME::Identifier;
-        #define KEYWORD_TOKEN(name, symbol) CASE(symbol) return TOKEN_CLASS_NAME::name;
+        return keywords.find(word).value_or(TOKEN_CLASS_NAME::Identifier);
+    }
+
+    /**
+     * All keywords declared with KEYWORD_TOKEN, followed by an empty sentinel entry.
+     */
+    static constexpr cpp20scanner::KeywordEntry<TOKEN_CLASS_NAME> keyword_entries[] = {
+        #define KEYWORD_TOKEN(name, symbol) {symbol, TOKEN_CLASS_NAME::name},
 #ifndef TOKEN
 #define TOKEN(name)
 #endif
@@ -1169,8 +1940,10 @@ TOKEN(Identifier)
 #undef KEYWORD_TOKEN
 #undef IGNORE_TOKEN
 #undef TOKEN
-        ENDMATCH;
-    }
+        {},
+    };
+
+    static constexpr cpp20scanner::KeywordTable keywords{keyword_entries};
 
     [[nodiscard]] cpp20scanner::Token<TOKEN_CLASS_NAME> scan_until_character(char token) noexcept
     {
@@ -1213,25 +1986,6 @@ TOKEN(Identifier)
         return make_token(TOKEN_CLASS_NAME::Raw);
     }
 
-    /**
-     * Increment line number.
-     */
-    void increment_line_number() noexcept 
-    {
-        std::size_t index {0};
-        bool is_newline = false;
-        char c {' '};
-
-        do 
-        {
-            if (is_newline) { line++; }
-            c = peek(index++);
-        } 
-        while ((is_newline = (c == '\n')) 
-             || c == '\t' 
-             || c == ' ');
-    }
-
     [[nodiscard]] cpp20scanner::Token<TOKEN_CLASS_NAME> scan_raw() noexcept
     {
         skip_whitespace();
@@ -1244,7 +1998,12 @@ TOKEN(Identifier)
         if (c==' ' || c=='\n') 
             return make_token(TOKEN_CLASS_NAME::Raw);
         
-        while (peek()!=' ' && peek()!='\n' && !is_at_end()) advance_position();
+        do
+        {
+            while (current < source_code.length() && peek()!=' ' && peek()!='\n') advance_position();
+        }
+        while (current == source_code.length() && refill(start));
+
         return make_token(TOKEN_CLASS_NAME::Raw);
     }
 
@@ -1253,8 +2012,6 @@ TOKEN(Identifier)
      */
     [[nodiscard]] cpp20scanner::Token<TOKEN_CLASS_NAME> scan_token() noexcept
     {
-        increment_line_number();
-        
         skip_whitespace();
         start = current;
 
@@ -1263,21 +2020,72 @@ TOKEN(Identifier)
             return make_token(TOKEN_CLASS_NAME::EndOfFile);
         }
 
-        const auto c = advance();
+        const auto c   = static_cast<unsigned char>(advance());
+        const auto cls = char_classes[c];
 
-        if (std::isdigit(c))
+        if (cls & cpp20scanner::classify::Digit)
         {
             return scan_number();
         }
-        else if (std::isalpha(c)) 
+        else if (cls & cpp20scanner::classify::Alpha) 
         {
             return scan_identifier();
         }
+        else if (cls & cpp20scanner::classify::Symbol)
+        {
+            return make_token(symbol_types[c]);
+        }
 
-        #define CCASE(character, token) break; case character: return make_token(token)
-        switch (c)
+        return error_token();
+    }
+
+    /**
+     * Returns true when the current position is
+     * the same as the source code's length.
+     */
+    [[nodiscard]] bool is_at_end() noexcept
+    {
+        return current >= this->source_code.length() && (reader == nullptr || reader->exhausted());
+    }
+    
+    /**
+     * Consume all whitespace.
+     */
+    void skip_whitespace() noexcept
+    {
+        while (true)
         {
-            #define SYMBOL_TOKEN(name, symbol) break; case symbol[0]: return make_token(TOKEN_CLASS_NAME::name);
+            current = cpp20scanner::classify::set_run(source_code, current, ignored_characters);
+
+            // Streaming mode, the run (or a lone '/') ends the window.
+            if (current == source_code.length() && refill(current))
+                continue;
+            if (peek() == '/' && current + 1 == source_code.length() && refill(current))
+                continue;
+
+            if (peek() == '/' && peek(1) == '/')
+            {
+                // The comment may span several windows.
+                auto eol = source_code.find('\n', current);
+                while (eol == std::string_view::npos && refill(source_code.length()))
+                    eol = source_code.find('\n');
+
+                current = (eol == std::string_view::npos) ? source_code.length() : eol;
+                continue;
+            }
+
+            return;
+        }
+    }
+
+    /**
+     * Class of every byte: the ASCII base classes plus the symbols and
+     * ignored characters declared in the token descriptor file.
+     */
+    static constexpr cpp20scanner::classify::ClassTable char_classes = [] {
+        auto table = cpp20scanner::classify::ascii_classes;
+        #define SYMBOL_TOKEN(name, symbol) table[static_cast<unsigned char>(symbol[0])] |= cpp20scanner::classify::Symbol;
+        #define IGNORE_TOKEN(character) table[static_cast<unsigned char>(character[0])] |= cpp20scanner::classify::Ignore;
 #ifndef TOKEN
 #define TOKEN(name)
 #endif
@@ -1300,30 +2108,16 @@ TOKEN(Identifier)
 #undef KEYWORD_TOKEN
 #undef IGNORE_TOKEN
 #undef TOKEN
-        }
-        #undef CCASE
-
-        return error_token(("Unexpected character: '" + c) + std::string("'"));
-    }
+        return table;
+    }();
 
     /**
-     * Returns true when the current position is
-     * the same as the source code's length.
+     * The token type of every byte classified as a symbol.
      */
-    [[nodiscard]] bool is_at_end() noexcept
-    {
-        return current >= this->source_code.length();
-    }
-    
-    /**
-     * Consume all whitespace.
-     */
-    void skip_whitespace() noexcept
-    {
-        while (true)
-        {
-            switch (peek())
-            {
+    static constexpr std::array<TOKEN_CLASS_NAME, 256> symbol_types = [] {
+        std::array<TOKEN_CLASS_NAME, 256> table{};
+        table.fill(TOKEN_CLASS_NAME::Error);
+        #define SYMBOL_TOKEN(name, symbol) table[static_cast<unsigned char>(symbol[0])] = TOKEN_CLASS_NAME::name;
 #ifndef TOKEN
 #define TOKEN(name)
 #endif
@@ -1334,31 +2128,25 @@ TOKEN(Identifier)
 #define SYMBOL_TOKEN(name, symbol) TOKEN(name)
 #endif
 #ifndef IGNORE_TOKEN
-#define IGNORE_TOKEN(character) break; case character[0]: { advance_position(); }
+#define IGNORE_TOKEN(character) TOKEN(character)
 #endif
+TOKEN(Error)
+TOKEN(Raw)
+TOKEN(EndOfFile)
+TOKEN(Number)
+TOKEN(Identifier)
 #include TOKEN_DESCRIPTOR_FILE
 #undef SYMBOL_TOKEN
 #undef KEYWORD_TOKEN
 #undef IGNORE_TOKEN
 #undef TOKEN
-                break; case '/':
-                {
-                    if (peek(1) == '/')
-                    {
-                        while(!is_at_end() && peek() != '\n')
-                        {
-                            advance_position();
-                        }
-                    }
-                    else
-                    {
-                        return;
-                    }
-                }
-                break; default: { return; }
-            }
-        }
-    }
+        return table;
+    }();
+
+    /**
+     * All characters marked by IGNORE_TOKEN.
+     */
+    static constexpr cpp20scanner::classify::ByteSet ignored_characters{char_classes, cpp20scanner::classify::Ignore};
 
   private:
     /**
@@ -1377,11 +2165,40 @@ TOKEN(Identifier)
         ++current;
     }
 
+    /**
+     * Streaming mode only. Replace the window with its bytes from `keep_from` onwards followed
+     * by the next chunk of input. Returns false when there is no more input.
+     *
+     * Once the kept bytes are longer than a chunk, as many bytes as are kept are read instead, so
+     * the window doubles while a token spans it. A token much longer than a chunk is then copied
+     * a logarithmic number of times, in amortized linear time.
+     */
+    bool refill(std::size_t keep_from)
+    {
+        if (reader == nullptr || reader->exhausted())
+            return false;
+
+        const auto  kept = source_code.substr(keep_from);
+        std::string window{};
+        window.reserve(kept.size() * 2);
+        window.append(kept);
+        if (!reader->read_into(window, kept.size()))
+            return false;
+
+        const auto origin = source_buffer->location(keep_from);
+
+        start   = (start >= keep_from) ? start - keep_from : 0;
+        current = current - keep_from;
+
+        this->source_buffer = cpp20scanner::SourceBuffer::from_string(std::move(window), origin);
+        this->source_code   = this->source_buffer->view();
+        return true;
+    }
+
     void reset() noexcept
     {
         start = 0;
         current = start;
-        line = 1;
     }
 
     /**
@@ -1415,23 +2232,28 @@ TOKEN(Identifier)
     [[nodiscard]] cpp20scanner::Token<TOKEN_CLASS_NAME> make_token(const TOKEN_CLASS_NAME type) noexcept 
     {
         const std::size_t length = current - start;
-        const auto what = this->source_code.substr(start, length);
-        return cpp20scanner::Token(type, this->source_code.substr(start, length), this->line);
+        return cpp20scanner::Token(type, this->source_code.substr(start, length), this->source_buffer.get());
     }
 
     /**
-     * Create an error token.
+     * Create an error token. The lexeme is the offending slice of the source.
      */
-    [[nodiscard]] cpp20scanner::Token<TOKEN_CLASS_NAME> error_token(const std::string& message) noexcept 
+    [[nodiscard]] cpp20scanner::Token<TOKEN_CLASS_NAME> error_token() noexcept 
     {
-        return cpp20scanner::Token(TOKEN_CLASS_NAME::Error, message, this->line);
+        return make_token(TOKEN_CLASS_NAME::Error);
     }
 
   private:
     std::size_t start{0};
     std::size_t current{start};
-    std::string source_code{};
-    std::size_t line{1};
+
+    // The buffer is shared so the scanner stays cheap to copy, source_code
+    // is a view into it.
+    std::shared_ptr<const cpp20scanner::SourceBuffer> source_buffer{};
+    std::string_view                                  source_code{};
+
+    // Set in streaming mode only.
+    std::shared_ptr<cpp20scanner::ChunkReader> reader{};
 };
 
 #undef SCANNER
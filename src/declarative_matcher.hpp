@@ -0,0 +1,316 @@
+#ifndef MACTEN_DECLARATIVE_MATCHER_HPP
+#define MACTEN_DECLARATIVE_MATCHER_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <memory_resource>
+#include <vector>
+
+#include "declarative_parameter.hpp"
+#include "token_stream.hpp"
+
+namespace macten
+{
+
+/**
+ * All arms of a declarative macro, compiled into one trie over their patterns.
+ *
+ * Each edge of the trie is one element of a pattern: a literal token (its type, and its symbol
+ * for identifiers and numbers) or a `$` capture, which takes a parenthesized group or a single
+ * token. Arms which start with the same elements share the path, so the input is walked once for
+ * the common prefix, and arms whose next literal does not match the input are never visited. A
+ * node lists the arms whose fixed pattern ends there; the variadic tail of those arms is checked
+ * from that node.
+ *
+ * Matching walks the trie from left to right, recording the span of every capture on the way,
+ * so choosing the arm and binding its arguments take a single pass. When several arms match, the
+ * first one wins, as if the arms were tried in order: subtrees are visited in the order of the
+ * first arm they contain, and skipped once they can not improve on the arm found.
+ */
+class DeclarativeMatcher
+{
+  private:
+    using Token     = MactenToken;
+    using TokenView = MactenTokenView;
+    using Captures  = std::pmr::vector<ArgumentSpan>;
+
+  public:
+    /**
+     * The arm which matched (-1 if none), and the index of the argument stream up to which the
+     * arm consumed the input.
+     */
+    struct Match
+    {
+        int         arm{-1};
+        std::size_t end{0};
+    };
+
+    /**
+     * Default Constructor. Returns a matcher without arms, which matches nothing.
+     */
+    DeclarativeMatcher() = default;
+
+    /**
+     * Compile the arms. Their literals must have been interned.
+     */
+    explicit DeclarativeMatcher(const std::vector<DeclarativeMacroParameter>& arms)
+    {
+        m_nodes.emplace_back();
+
+        // Arms are added in order, so the children of every node are ordered by the first arm
+        // they lead to.
+        for (std::size_t arm{0}; arm < arms.size(); arm++)
+        {
+            insert(static_cast<std::uint32_t>(arm), arms[arm]);
+        }
+    }
+
+    /**
+     * Match the arguments against the arms the matcher was compiled from. On success the captures
+     * of the arm are stored in `captures`, in the order DeclarativeMacroParameter::bind() expects.
+     * The symbols of the input must have been resolved if any pattern contains literals.
+     *
+     * Variadic tails are looked up in `known` before they are matched, and the repetitions of the
+     * tail of the arm which matches are recorded in `repetitions`, see VariadicRepetitions.
+     */
+    [[nodiscard]] auto match(const std::vector<DeclarativeMacroParameter>& arms, const ATS::View& input,
+                             Captures& captures, const VariadicRepetitions* known,
+                             VariadicRepetitions& repetitions) const -> Match
+    {
+        captures.clear();
+        if (m_nodes.empty())
+        {
+            return {};
+        }
+
+        Search search{
+            .arms     = arms,
+            .path     = Captures{captures.get_allocator()},
+            .captures    = captures,
+            .known       = known,
+            .repetitions = repetitions,
+            .end         = std::min(input.size(), input.target()->size()),
+        };
+
+        visit(0, TokenView(input), input.position(), search);
+
+        if (search.best == no_arm)
+        {
+            return {};
+        }
+        return {static_cast<int>(search.best), search.consumed};
+    }
+
+  private:
+    static constexpr std::uint32_t no_arm{UINT32_MAX};
+
+    /**
+     * One element of a pattern.
+     */
+    struct Element
+    {
+        bool   capture{false};
+        Token  type{Token::Error};
+        Symbol symbol{no_symbol};
+
+        [[nodiscard]] auto operator==(const Element& other) const noexcept -> bool = default;
+    };
+
+    /**
+     * A trie node. The element is the label of the edge leading to the node.
+     */
+    struct Node
+    {
+        Element                    element{};
+        std::vector<std::uint32_t> children{};
+        std::vector<std::uint32_t> arms{};
+        std::uint32_t              first_arm{0};
+    };
+
+    /**
+     * State of a match. `path` holds the captures of the current trie path, `captures` those of
+     * the best arm found so far.
+     */
+    struct Search
+    {
+        const std::vector<DeclarativeMacroParameter>& arms;
+        Captures                                      path;
+        Captures&                                     captures;
+        const VariadicRepetitions*                    known{nullptr};
+        VariadicRepetitions&                          repetitions;
+        std::size_t                                   end{0};
+        std::uint32_t                                 best{no_arm};
+        std::size_t                                   consumed{0};
+    };
+
+    /**
+     * Add the fixed pattern of an arm to the trie.
+     */
+    auto insert(std::uint32_t arm, const DeclarativeMacroParameter& param) -> void
+    {
+        std::uint32_t node{0};
+
+        for (std::size_t index{0}; index < param.pattern.size(); index++)
+        {
+            const auto type = param.pattern.type_at(index);
+
+            Element element{};
+            if (type == Token::Dollar)
+            {
+                element.capture = true;
+            }
+            else
+            {
+                element.type   = type;
+                element.symbol = param.pattern.symbol_at(index);
+            }
+
+            node = child(node, element, arm);
+        }
+
+        m_nodes[node].arms.push_back(arm);
+    }
+
+    /**
+     * Returns the child of the node along the element, adding it for the arm if there is none.
+     */
+    auto child(std::uint32_t node, const Element& element, std::uint32_t arm) -> std::uint32_t
+    {
+        for (const auto index : m_nodes[node].children)
+        {
+            if (m_nodes[index].element == element)
+            {
+                return index;
+            }
+        }
+
+        const auto index = static_cast<std::uint32_t>(m_nodes.size());
+        m_nodes.push_back(Node{.element = element, .first_arm = arm});
+        m_nodes[node].children.push_back(index);
+        return index;
+    }
+
+    /**
+     * Visit the node with the input which remains after its path, `consumed` being the index
+     * just past the last token the path took.
+     */
+    auto visit(std::uint32_t index, const TokenView& input, std::size_t consumed, Search& search) const
+        -> void
+    {
+        const auto& node = m_nodes[index];
+
+        for (const auto arm : node.arms)
+        {
+            if (arm >= search.best)
+            {
+                break;
+            }
+
+            if (accepts(search.arms[arm], input, search))
+            {
+                search.best     = arm;
+                search.consumed = consumed;
+                search.captures.assign(search.path.begin(), search.path.end());
+
+                // The variadic tail is everything after the fixed pattern.
+                if (search.arms[arm].pattern_mode != DeclarativeMacroParameter::PatternMode::Normal)
+                {
+                    search.captures.push_back({consumed, search.end});
+                    search.consumed = search.end;
+                }
+                break;
+            }
+        }
+
+        for (const auto child_index : node.children)
+        {
+            const auto& child = m_nodes[child_index];
+            if (child.first_arm >= search.best)
+            {
+                break;
+            }
+
+            auto next = input;
+
+            if (!child.element.capture)
+            {
+                if (!matches(child.element, next))
+                {
+                    continue;
+                }
+
+                const auto position = next.position();
+                next.advance();
+                visit(child_index, next, position + 1, search);
+                continue;
+            }
+
+            // A group is captured without its parentheses, an exhausted input captures nothing.
+            ArgumentSpan span{next.position(), next.position()};
+            auto         next_consumed = consumed;
+
+            if (next.peek_type() == Token::LParen)
+            {
+                next.advance();
+                span.begin = next.position();
+
+                const auto body = next.between(Token::LParen, Token::RParen);
+                next.advance(body.remaining_size());
+                span.end = next.position();
+
+                next_consumed = std::min(span.end + 1, search.end);
+                next.advance();
+            }
+            else if (!next.is_at_end())
+            {
+                span.end = span.begin + 1;
+                next_consumed = span.end;
+                next.advance();
+            }
+
+            search.path.push_back(span);
+            visit(child_index, next, next_consumed, search);
+            search.path.pop_back();
+        }
+    }
+
+    /**
+     * Returns true if the top input token is the literal.
+     */
+    [[nodiscard]] static auto matches(const Element& element, const TokenView& input) noexcept -> bool
+    {
+        if (input.peek_type() != element.type)
+        {
+            return false;
+        }
+
+        return (element.type != Token::Identifier && element.type != Token::Number) ||
+               input.peek_symbol() == element.symbol;
+    }
+
+    /**
+     * Returns true if the arm accepts the input which remains after its fixed pattern.
+     */
+    [[nodiscard]] static auto accepts(const DeclarativeMacroParameter& param, const TokenView& input,
+                                      Search& search) -> bool
+    {
+        using PatternMode = DeclarativeMacroParameter::PatternMode;
+
+        if (param.is_pattern_mode(PatternMode::Normal) || param.is_pattern_mode(PatternMode::Empty))
+        {
+            // Valid if input is exhausted. There shouldn't be more to match.
+            return input.is_exhausted();
+        }
+
+        return param.match_variadic(input, search.known, &search.repetitions);
+    }
+
+    /**
+     * Members.
+     */
+    std::vector<Node> m_nodes;
+};
+
+} // namespace macten
+
+#endif /* MACTEN_DECLARATIVE_MATCHER_HPP */
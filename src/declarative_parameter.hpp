@@ -1,14 +1,183 @@
 #ifndef MACTEN_DECLARATIVE_PARAMETER_HPP
 #define MACTEN_DECLARATIVE_PARAMETER_HPP
 
-#include <map>
+#include <algorithm>
+#include <memory_resource>
 #include <optional>
+#include <string>
+#include <utility>
+#include <vector>
 
 #include "token_stream.hpp"
 
 namespace macten
 {
 
+/**
+ * The tokens [begin, end) of an argument stream, captured for a parameter.
+ */
+struct ArgumentSpan
+{
+    std::size_t begin{0};
+    std::size_t end{0};
+};
+
+/**
+ * The arguments of a macro invocation: the span of the argument stream bound to each parameter
+ * name. Arguments are never copied out of the stream, they are substituted by viewing their
+ * tokens. A macro binds few arguments, so the bindings are a flat vector, allocated from the
+ * arena of the invocation.
+ *
+ * NOTE: The argument stream must outlive the environment.
+ */
+class ArgumentEnvironment
+{
+  public:
+    ArgumentEnvironment(const ATS& source, std::pmr::memory_resource* resource)
+        : m_source{&source}
+        , m_bindings{resource}
+    {
+    }
+
+    /**
+     * Bind the span to the name, replacing an earlier binding of the same name.
+     */
+    auto bind(Symbol name, const ArgumentSpan& span) -> void
+    {
+        for (auto& binding : m_bindings)
+        {
+            if (binding.first == name)
+            {
+                binding.second = span;
+                return;
+            }
+        }
+        m_bindings.emplace_back(name, span);
+    }
+
+    /**
+     * Returns the span bound to the name, or nullptr if it is not bound.
+     */
+    [[nodiscard]] auto find(Symbol name) const noexcept -> const ArgumentSpan*
+    {
+        for (const auto& binding : m_bindings)
+        {
+            if (binding.first == name)
+            {
+                return &binding.second;
+            }
+        }
+        return nullptr;
+    }
+
+    /**
+     * Returns the span of the binding at `slot`, the position of the binding in the environment.
+     */
+    [[nodiscard]] auto at(std::size_t slot) const noexcept -> const ArgumentSpan&
+    {
+        return m_bindings[slot].second;
+    }
+
+    /**
+     * Returns a view of the tokens of the span.
+     */
+    [[nodiscard]] auto view(const ArgumentSpan& span) const noexcept -> ATS::View
+    {
+        return ATS::View(span.begin, span.end, m_source);
+    }
+
+    /**
+     * Returns the argument stream.
+     */
+    [[nodiscard]] auto source() const noexcept -> const ATS&
+    {
+        return *m_source;
+    }
+
+    /**
+     * Returns the number of names bound.
+     */
+    [[nodiscard]] auto size() const noexcept -> std::size_t
+    {
+        return m_bindings.size();
+    }
+
+  private:
+    const ATS*                                        m_source;
+    std::pmr::vector<std::pair<Symbol, ArgumentSpan>> m_bindings;
+};
+
+/**
+ * The positions at which the repetitions of a variadic pattern start in the tail of an argument
+ * stream, recorded when the tail is matched.
+ *
+ * A tail which starts at one of the positions, and ends where the recorded one does, is made of
+ * whole repetitions as well. A recursive macro which passes its tail on to itself, such as
+ * `($x, $($y,)) => {min($x, min![$y])}`, looks the tail of each level up here instead of matching
+ * the rest of the list again.
+ */
+class VariadicRepetitions
+{
+  public:
+    explicit VariadicRepetitions(std::pmr::memory_resource* resource)
+        : m_starts{resource}
+    {
+    }
+
+    /**
+     * Start recording the repetitions of the pattern in the tail of `source` which ends at `end`.
+     */
+    auto begin(const ATS* source, const TS* pattern, std::size_t end) -> void
+    {
+        m_source  = source;
+        m_pattern = pattern;
+        m_end     = end;
+        m_starts.clear();
+    }
+
+    /**
+     * Record the position at which the next repetition starts. Positions must increase.
+     */
+    auto push(std::size_t start) -> void
+    {
+        m_starts.push_back(start);
+    }
+
+    /**
+     * Forget the recorded repetitions, e.g. when the tail turns out not to match.
+     */
+    auto clear() noexcept -> void
+    {
+        m_source = nullptr;
+        m_starts.clear();
+    }
+
+    /**
+     * Returns true if the tail [start, end) of `source` is known to be made of repetitions of
+     * the pattern.
+     */
+    [[nodiscard]] auto contains(const ATS* source, const TS* pattern, std::size_t start, std::size_t end) const
+        -> bool
+    {
+        return source != nullptr && source == m_source && pattern == m_pattern && end == m_end &&
+               std::binary_search(m_starts.begin(), m_starts.end(), start);
+    }
+
+    /**
+     * Returns true if nothing is recorded.
+     */
+    [[nodiscard]] auto empty() const noexcept -> bool
+    {
+        return m_source == nullptr;
+    }
+
+  private:
+    const ATS*                    m_source{nullptr};
+    const TS*                     m_pattern{nullptr};
+    std::size_t                   m_end{0};
+    std::pmr::vector<std::size_t> m_starts;
+};
+
 struct DeclarativeMacroParameter
 {
   private:
@@ -82,7 +251,7 @@ struct DeclarativeMacroParameter
             break;
             case Token::Identifier:
             {
-                argument_names.push_back(parameter_view.pop().lexeme);
+                argument_names.emplace_back(parameter_view.pop().lexeme);
                 pattern.push_back(tok);
             }
             break;
@@ -115,6 +284,38 @@ struct DeclarativeMacroParameter
         }
     }
 
+    /**
+     * Intern the argument names and the literals of the patterns, so they are compared by symbol.
+     */
+    auto intern(SymbolTable& symbols) -> void
+    {
+        pattern.intern_symbols(symbols);
+        variadic_pattern.intern_symbols(symbols);
+
+        argument_symbols.clear();
+        for (const auto& name : argument_names)
+        {
+            argument_symbols.push_back(symbols.intern(name));
+        }
+
+        if (!variadic_container_name.empty())
+        {
+            variadic_container_symbol = symbols.intern(variadic_container_name);
+        }
+    }
+
+    /**
+     * Returns true if the patterns contain identifiers or numbers, which are matched by symbol.
+     */
+    [[nodiscard]] auto has_literals() const noexcept -> bool
+    {
+        const auto is_literal = [](const auto& token) {
+            return token.any_of(Token::Identifier, Token::Number);
+        };
+        return std::any_of(pattern.begin(), pattern.end(), is_literal) ||
+               std::any_of(variadic_pattern.begin(), variadic_pattern.end(), is_literal);
+    }
+
     /**
      * Set pattern mode.
      */
@@ -133,19 +334,42 @@ struct DeclarativeMacroParameter
 
     /**
      * Checks whether the input arguments matches the variadic template.
+     *
+     * An input which `known` already holds the repetitions of is not matched again. Otherwise the
+     * repetitions of a matching input are recorded in `record`, if given.
      */
-    [[nodiscard]] auto match_variadic(TS::View input) const noexcept -> bool
+    template <typename View>
+    [[nodiscard]] auto match_variadic(View input, const VariadicRepetitions* known = nullptr,
+                                      VariadicRepetitions* record = nullptr) const -> bool
     {
         if (variadic_pattern.empty() || input.is_exhausted())
         {
             return false;
         }
 
+        if (known != nullptr &&
+            known->contains(input.target(), &variadic_pattern, input.position(), input.end()))
+        {
+            return true;
+        }
+
+        if (record != nullptr)
+        {
+            record->begin(input.target(), &variadic_pattern, input.end());
+        }
+
         while (!input.is_exhausted())
         {
-            for (const auto& current_expected_token : variadic_pattern)
+            if (record != nullptr)
             {
-                if (current_expected_token.is(Token::Dollar))
+                record->push(input.position());
+            }
+
+            for (std::size_t index{0}; index < variadic_pattern.size(); index++)
+            {
+                const auto expected_type = variadic_pattern.type_at(index);
+
+                if (expected_type == Token::Dollar)
                 {
                     if (input.pop().is(Token::LParen))
                     {
@@ -155,17 +379,12 @@ struct DeclarativeMacroParameter
                     continue;
                 }
 
-                const auto token              = input.pop();
-                const auto current_token_type = token.type;
-                if (current_token_type != current_expected_token.type)
-                {
-                    return false;
-                }
-
-                // Lexeme (keyword) mismatch.
-                if (current_expected_token.any_of(Token::Identifier, Token::Number) &&
-                    !token.lexically_eq(current_expected_token))
+                if (!match_token(input, variadic_pattern, index))
                 {
+                    if (record != nullptr)
+                    {
+                        record->clear();
+                    }
                     return false;
                 }
             }
@@ -175,126 +394,97 @@ struct DeclarativeMacroParameter
     }
 
     /**
-     *
+     * Pop the top input token, returns true if it matches the expected pattern token. Only the
+     * types are compared, except for identifiers and numbers which must have the same symbol.
+     * The symbols of the input must have been resolved against the table the pattern was
+     * interned in.
      */
-    [[nodiscard]] auto is_parameterless(TS::View input) const noexcept -> bool
+    template <typename View>
+    [[nodiscard]] static auto match_token(View& input, const TS& expected_tokens, std::size_t index) noexcept
+        -> bool
     {
-        return (input.peek().is(Token::EndOfFile) && pattern_mode == PatternMode::Empty);
+        const auto expected_type = expected_tokens.type_at(index);
+        const auto input_type    = input.peek_type();
+
+        if (input_type != expected_type)
+            return false;
+
+        // Lexeme (keyword) mismatch.
+        if ((expected_type == Token::Identifier || expected_type == Token::Number) &&
+            input.peek_symbol() != expected_tokens.symbol_at(index))
+        {
+            return false;
+        }
+
+        input.advance();
+        return true;
     }
 
     /**
-     * Checks whether the input token stream matches the pattern of the expected parameters or not.
+     * Bind the spans captured by a match of this parameter to the argument names. The captures
+     * are the spans of the `$` elements of the pattern in order, followed by the span of the
+     * variadic tail unless the pattern mode is Normal.
      */
-    [[nodiscard]] auto match(TS::View input) const noexcept -> bool
+    [[nodiscard]] auto bind(const ATS& source, const std::pmr::vector<ArgumentSpan>& captures,
+                            std::pmr::memory_resource* resource) const -> ArgumentEnvironment
     {
-        if (is_parameterless(input))
-            return true;
+        ArgumentEnvironment args{source, resource};
 
-        for (const auto& current_expected_token : pattern)
+        for (std::size_t index{0}; index < argument_symbols.size() && index < captures.size(); index++)
         {
-            if (current_expected_token.type == Token::Dollar)
-            {
-                if (input.peek().is(Token::LParen))
-                {
-                    input.advance();
-                    const auto body = input.between(Token::LParen, Token::RParen);
-                    input.advance(body.remaining_size() + 1);
-                }
-                else
-                {
-                    input.advance();
-                }
-                continue;
-            }
-
-            const auto token              = input.pop();
-            const auto current_token_type = token.type;
-
-            if (current_token_type != current_expected_token.type)
-                return false;
-
-            // Lexeme (keyword) mismatch.
-            if (current_expected_token.any_of(Token::Identifier, Token::Number) &&
-                !token.lexically_eq(current_expected_token))
-            {
-                return false;
-            }
+            args.bind(argument_symbols[index], captures[index]);
         }
 
-        if (is_pattern_mode(PatternMode::Normal))
+        if (pattern_mode != PatternMode::Normal && variadic_container_symbol != no_symbol &&
+            captures.size() > argument_symbols.size())
         {
-            // Valid if input is exhausted. There shouldn't be more to match.
-            return input.is_exhausted();
+            args.bind(variadic_container_symbol, captures.back());
         }
 
-        return match_variadic(input);
+        return args;
     }
 
     /**
-     * Match pattern with the input and retrieve argument names and their value.
+     * Returns the slot of the name in the environments bind() returns, or none if the name is
+     * not a parameter. Names are bound in the order they first appear, the variadic container
+     * last, so the slot does not depend on the arguments.
      */
-    [[nodiscard]] auto map_args(ATS::View& input) const noexcept
-        -> std::optional<std::map<std::string, std::string>>
+    [[nodiscard]] auto slot(Symbol name) const -> std::optional<std::size_t>
     {
-        std::map<std::string, std::string> argmap{};
-        std::size_t                        argcount{0};
-
-        for (const auto& expected : pattern)
+        std::vector<Symbol> bound{};
+        for (const auto symbol : argument_symbols)
         {
-            const auto& expected_tty = expected.type;
-            input.skip(AllToken::Newline, AllToken::Tab, AllToken::Space);
-            const auto token = input.pop();
-
-            if (expected_tty == Token::Dollar)
+            if (std::find(bound.begin(), bound.end(), symbol) == bound.end())
             {
-                // Arity error.
-                if ((argcount + 1) > argument_names.size())
-                {
-                    std::cerr << "Arity error, declared parameter count mismatched.\n";
-                    return {};
-                }
-
-                std::string        argval{};
-                const std::string& argname = argument_names[argcount];
-
-                // Handle grouping.
-                if (token.is(AllToken::LParen))
-                {
-                    const auto expr = input.between(AllToken::LParen, AllToken::RParen);
-                    input.advance(expr.remaining_size() + 1);
-                    argval = expr.construct();
-                }
-                else
-                {
-                    argval = token.lexeme;
-                }
-
-                argmap[argname] = argval;
-
-                argcount++;
-            }
-            else if (token.type.name() != expected_tty.name())
-            {
-                return {};
+                bound.push_back(symbol);
             }
         }
 
-        if (pattern_mode != PatternMode::Normal)
+        if (pattern_mode != PatternMode::Normal && variadic_container_symbol != no_symbol &&
+            std::find(bound.begin(), bound.end(), variadic_container_symbol) == bound.end())
         {
-            argmap[variadic_container_name] = input.construct();
-
-            while (!input.is_at_end())
-                input.advance();
+            bound.push_back(variadic_container_symbol);
         }
 
-        return argmap;
+        const auto found = std::find(bound.begin(), bound.end(), name);
+        if (found == bound.end())
+        {
+            return {};
+        }
+        return static_cast<std::size_t>(found - bound.begin());
     }
 
-    PatternMode                             pattern_mode{};
-    std::vector<cpp20scanner::Token<Token>> pattern{};
-    std::vector<std::string>                argument_names{};
-    std::string                             variadic_container_name{};
-    std::vector<cpp20scanner::Token<Token>> variadic_pattern{};
+    // The patterns are token streams (rather than plain vectors) so they keep the source
+    // of the parameter signature alive.
+    PatternMode              pattern_mode{};
+    TS                       pattern{};
+    std::vector<std::string> argument_names{};
+    std::string              variadic_container_name{};
+    TS                       variadic_pattern{};
+
+    // Symbols of the names above, set by intern().
+    std::vector<Symbol> argument_symbols{};
+    Symbol              variadic_container_symbol{no_symbol};
 };
 
 } // namespace macten
@@ -0,0 +1,208 @@
+#ifndef MACTEN_EXPANSION_CACHE_HPP
+#define MACTEN_EXPANSION_CACHE_HPP
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <list>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#include "macten_all_tokens.hpp"
+#include "symbol_table.hpp"
+#include "token_stream.hpp"
+
+namespace macten
+{
+
+/**
+ * Expansions of declarative macro calls, keyed by the macro and the tokens of its arguments.
+ *
+ * The expansion of a declarative macro only depends on the macro and on the type and lexeme of
+ * its argument tokens, so it is recorded once and replayed whenever the same call is seen
+ * again. The recorded streams own their lexemes, they do not keep the source alive.
+ *
+ * A call is recorded when it is seen for the second time. The cache holds at most `budget` bytes
+ * of keys and expansions. When it is full, the entries used least recently are evicted.
+ * Expansions which are larger than the budget on their own are not recorded.
+ *
+ * NOTE: Expansions which call procedural macros are not pure and must not be recorded. The
+ *       caller is responsible for bypassing the cache for them.
+ */
+class ExpansionCache
+{
+  private:
+    using Stream = TokenStream<MactenAllToken>;
+    using View   = Stream::TokenStreamView;
+
+  public:
+    struct Stats
+    {
+        std::size_t hits{0};
+        std::size_t misses{0};
+        std::size_t bypasses{0};
+        std::size_t evictions{0};
+    };
+
+    /**
+     * Construct a cache holding at most `budget` bytes.
+     */
+    explicit ExpansionCache(std::size_t budget)
+        : m_budget{budget}
+    {
+    }
+
+    /**
+     * Build the key of a call into `key`, replacing its content. The key is the macro followed by
+     * the type, the length and the lexeme of every argument token.
+     */
+    template <typename String>
+    static auto make_key(String& key, Symbol macro, const View& args) -> void
+    {
+        key.clear();
+        append_bytes(key, macro);
+
+        const auto& stream = *args.target();
+        const auto  end    = std::min(args.size(), stream.size());
+        for (auto index = args.position(); index < end; ++index)
+        {
+            const auto lexeme = stream.get(index).lexeme;
+            append_bytes(key, stream.type_at(index));
+            append_bytes(key, static_cast<std::uint32_t>(lexeme.size()));
+            key.append(lexeme);
+        }
+    }
+
+    /**
+     * Returns the expansion recorded for the key, or nullptr if there is none. A hit makes the
+     * entry the most recently used.
+     */
+    [[nodiscard]] auto find(std::string_view key) -> const Stream*
+    {
+        const auto found = m_index.find(key);
+        if (found == m_index.end())
+        {
+            m_stats.misses++;
+            return nullptr;
+        }
+
+        m_stats.hits++;
+        m_entries.splice(m_entries.begin(), m_entries, found->second);
+        return &found->second->expansion;
+    }
+
+    /**
+     * Record the tokens [begin, end) of the stream as the expansion of the key, evicting the
+     * entries used least recently to make room.
+     */
+    auto insert(std::string_view key, const Stream& stream, std::size_t begin, std::size_t end) -> void
+    {
+        if (m_index.contains(key))
+        {
+            return;
+        }
+
+        // Calls are recorded the second time they are seen, so calls which are never repeated
+        // do not pay for a copy of their expansion.
+        const auto hash = std::hash<std::string_view>{}(key);
+        auto&      seen = m_seen[hash % m_seen.size()];
+        if (seen != hash)
+        {
+            seen = hash;
+            return;
+        }
+
+        auto       expansion = stream.detach(begin, end);
+        const auto bytes     = entry_overhead + key.size() + expansion.footprint();
+        if (bytes > m_budget)
+        {
+            return;
+        }
+
+        while (m_size + bytes > m_budget)
+        {
+            evict();
+        }
+
+        m_entries.push_front(Entry{std::string(key), std::move(expansion), bytes});
+        m_index.emplace(m_entries.front().key, m_entries.begin());
+        m_size += bytes;
+    }
+
+    /**
+     * Count a call which did not use the cache.
+     */
+    auto bypass() noexcept -> void
+    {
+        m_stats.bypasses++;
+    }
+
+    [[nodiscard]] auto stats() const noexcept -> const Stats&
+    {
+        return m_stats;
+    }
+
+    /**
+     * Returns the number of bytes held.
+     */
+    [[nodiscard]] auto size() const noexcept -> std::size_t
+    {
+        return m_size;
+    }
+
+  private:
+    struct Entry
+    {
+        std::string key;
+        Stream      expansion;
+        std::size_t bytes;
+    };
+
+    // Estimated bytes of bookkeeping per entry: the list node and the index node.
+    static constexpr std::size_t entry_overhead{sizeof(Entry) + 64};
+
+    // Number of calls seen once which are remembered, by hash. A call whose slot has since been
+    // taken by another call is recorded on the next time it is seen instead.
+    static constexpr std::size_t seen_slots{std::size_t{1} << 16};
+
+    template <typename String, typename T>
+    static auto append_bytes(String& key, T value) -> void
+    {
+        char bytes[sizeof(T)];
+        std::memcpy(bytes, &value, sizeof(T));
+        key.append(bytes, sizeof(T));
+    }
+
+    /**
+     * Remove the entry used least recently.
+     */
+    auto evict() -> void
+    {
+        const auto& entry = m_entries.back();
+        m_index.erase(entry.key);
+        m_size -= entry.bytes;
+        m_entries.pop_back();
+        m_stats.evictions++;
+    }
+
+    /**
+     * Members.
+     */
+    std::size_t m_budget;
+    std::size_t m_size{0};
+    Stats       m_stats{};
+
+    // Entries from the most to the least recently used. The index keys view the keys of the
+    // entries, which list nodes keep in place.
+    std::list<Entry>                                                  m_entries;
+    std::unordered_map<std::string_view, std::list<Entry>::iterator> m_index;
+
+    // Hashes of the keys of calls seen once, see insert().
+    std::vector<std::size_t> m_seen = std::vector<std::size_t>(seen_slots, 0);
+};
+
+} // namespace macten
+
+#endif /* MACTEN_EXPANSION_CACHE_HPP */
@@ -3,102 +3,136 @@
 #include "utils.hpp"
 
 /**
- * Apply declarative template macro on the target token stream. This function returns the succcess status of the macro expansion.
+ * Apply declarative template macro on the target token stream. This function returns the progress of the macro expansion.
  * Note that the expansion is recursive, which is why we need to pass in MactenWriter pointer so we can further expand the contents of our macro expansion.
+ * Nested declarative calls, and those the rescan of the expansion finds, are pushed on the expansion stack of the writer, the frame is applied again from its current step once they are done.
  * TODO: Better error diagnostics would be great.
  */
 auto macten::DeclarativeTemplate::apply(
      macten::MactenWriter* env,
-     const int index,
-     macten::TokenStream<MactenAllToken>& target, 
-     std::map<std::string, std::string> args
-) const -> bool 
+     macten::ExpansionFrame& frame
+) const -> ExpansionStatus
  {
    using TokenType = MactenAllToken;
-   macten::TokenStream<MactenAllToken> temp_buffer;
 
-   // Check arity.
-   if (m_params[index].pattern_mode == DeclarativeMacroParameter::PatternMode::Normal && args.size() != m_params[index].argument_names.size()) return false;
+   const auto  index = frame.arm->index;
+   const auto& args  = frame.arm->args;
 
-   auto view = m_token_stream[index].get_view();
+   // Check arity. A resumed frame is past the first step.
+   if (frame.step == 0 && m_params[index].pattern_mode == DeclarativeMacroParameter::PatternMode::Normal && args.size() != m_params[index].argument_names.size()) return ExpansionStatus::Failed;
 
-   while (!view.is_at_end())
-   {
-    const bool _is_arg {
-     view.match_sequence(TokenType::Dollar, TokenType::Identifier)
-    };
-    const bool is_macro_call { macten::utils::is_macro_call(view) };
+   const auto& body  = m_token_stream[index];
+   const auto& steps = m_plans[index].steps();
 
+   // A binding the match did not make is copied as it is written.
+   const auto bound = [&](const SubstitutionPlan::Step& step) { return step.slot < args.size(); };
 
-    const auto _token = view.peek();
+   while (frame.step < steps.size())
+   {
+    const auto& step = steps[frame.step];
 
-    if (_is_arg)
+    switch (step.kind)
     {
-     const std::string argname = view.peek(1).lexeme;
-     if (args.contains(argname))
+     break;
+     case SubstitutionPlan::StepKind::Literal:
+     {
+      env->pending(frame).append(body, step.begin, step.end);
+      frame.step++;
+     }
+     break;
+     case SubstitutionPlan::StepKind::Parameter:
      {
-       view.advance();
-       const std::string& arg_value = args[argname];
-       const auto sub_ts = macten::TokenStream<MactenAllToken>::from_string(arg_value);
-       auto sub_view = sub_ts.get_view();
+      if (bound(step))
+      {
+       // The argument is substituted straight from the tokens it was bound to.
+       auto sub_view = args.view(args.at(step.slot));
 
        // A little ugly, but this is the best way to trim.
        static_cast<void>(sub_view.consume(TokenType::Tab, TokenType::Space));
-       env->apply_macro_rules(temp_buffer, sub_view);
+
+       // The argument is expanded as it is substituted, the final rescan passes it on.
+       auto&      pending = env->pending(frame);
+       const auto begin   = pending.size();
+       env->apply_macro_rules(pending, sub_view, &frame.arena);
+       frame.expanded.push_back({begin, pending.size()});
+      }
+      else
+      {
+       env->pending(frame).append(body, step.begin, step.end);
+      }
+      frame.step++;
      }
-     else
+     break;
+     case SubstitutionPlan::StepKind::Call:
      {
-       temp_buffer.push_back(_token);
-     }
-    }
-    else if (is_macro_call & env->has_declarative_macro(_token.lexeme))
-    {
-      auto arg_body = view.between(MactenAllToken::LSquare, MactenAllToken::RSquare, false);
-      view.advance(arg_body.remaining_size()+3);
+      // Not a declarative macro, the call site is substituted like the rest of the body.
+      if (!env->has_declarative_macro(step.macro))
+      {
+       frame.step = step.arguments_end;
+       break;
+      }
 
-      std::stringstream args_string {};
+      if (const auto status = env->prepare_call(frame); status != ExpansionStatus::Finished)
+      {
+       return status;
+      }
 
-      while (!arg_body.is_at_end()) 
+      const auto  first = frame.step + 1;
+      const auto& piece = steps[first];
+
+      // A single argument is passed on as the tokens it was bound to, e.g. the tail of a recursive variadic macro,
+      // and literal arguments as the tokens of the body.
+      // Otherwise the arguments are substituted into the nested call's argument list, token by token.
+      const bool single         = step.arguments_end == first + 1;
+      const bool literal        = single && piece.kind == SubstitutionPlan::StepKind::Literal;
+      const bool bound_in_place = single && piece.kind == SubstitutionPlan::StepKind::Parameter && bound(piece);
+      if (!literal && !bound_in_place)
       {
-        const bool is_arg { arg_body.match_sequence(TokenType::Dollar, TokenType::Identifier) };
-        const auto token = arg_body.peek();
+       // Pieces after the first may run into the tokens before them, e.g. `id![$a$b]`, as they did
+       // when the arguments were scanned again after substitution.
+       auto& nested_args = env->nested_arguments(frame);
+       for (auto argument = first; argument < step.arguments_end; argument++)
+       {
+        const auto& argument_piece = steps[argument];
+        const bool  substituted    = argument_piece.kind == SubstitutionPlan::StepKind::Parameter && bound(argument_piece);
+        const auto& source         = substituted ? args.source() : body;
+        const auto  piece_begin    = substituted ? args.at(argument_piece.slot).begin : argument_piece.begin;
+        const auto  piece_end      = substituted ? args.at(argument_piece.slot).end : argument_piece.end;
 
-        if (is_arg)
+        if (argument == first)
         {
-         const std::string argname = arg_body.peek(1).lexeme;
-         if (args.contains(argname))
-         {
-           arg_body.advance();
-           const std::string& arg_value = args[argname];
-           args_string << arg_value;
-         }
-         else
-         {
-           args_string << token.lexeme;
-         }
+         nested_args.append(source, piece_begin, piece_end);
         }
         else
         {
-         args_string << token.lexeme;
+         utils::append_rejoined(nested_args, source, piece_begin, piece_end);
         }
-        arg_body.advance();
+       }
       }
 
-      if (!env->match_and_execute_macro(temp_buffer, _token.lexeme, args_string.str()))
+      const auto nested_view = literal          ? ATS::View(piece.begin, piece.end, &body)
+                             : bound_in_place ? args.view(args.at(piece.slot))
+                                              : frame.nested_args->get_view();
+
+      frame.step = step.next;
+      if (const auto status = env->call_macro(frame, step.macro, nested_view); status != ExpansionStatus::Finished)
       {
-       return false;
+       return status;
       }
+     }
+     break;
+     case SubstitutionPlan::StepKind::Inlined:
+     {
+      // Expanded when the macro was defined, it is inserted as the call's expansion would be.
+      if (const auto status = env->prepare_call(frame); status != ExpansionStatus::Finished)
+      {
+       return status;
+      }
+      env->insert_expansion(frame, m_plans[index].expansion(step.slot));
+      frame.step = step.next;
+     }
     }
-    else 
-    {
-     temp_buffer.push_back(_token);
-    }
-
-    view.advance();
    }
 
-   auto temp_buffer_view = temp_buffer.get_view();
-   env->apply_macro_rules(target, temp_buffer_view);
-
-   return true;
+   return env->flush(frame);
  }
@@ -2,10 +2,15 @@
 #define MACTEN_HPP
 
 #include <algorithm>
+#include <array>
+#include <deque>
 #include <memory>
+#include <memory_resource>
+#include <span>
 #include <string>
 #include <unordered_map>
 #include <unordered_set>
+#include <utility>
 #include <vector>
 #include <filesystem>
 #include <unistd.h>
@@ -15,15 +20,32 @@
 #include "macten_tokens.hpp"
 #include "prod_macro_def.hpp"
 #include "prod_macro_writer.hpp"
+#include "run_stats.hpp"
+#include "symbol_table.hpp"
 #include "token_stream.hpp"
 #include "utils.hpp"
 
+#include "declarative_matcher.hpp"
 #include "declarative_parameter.hpp"
+#include "expansion_cache.hpp"
+#include "substitution_plan.hpp"
 
 namespace macten {
 
 
 class MactenWriter;
+struct ExpansionFrame;
+
+/**
+ * Progress of the expansion of a macro call. An expansion is suspended when it reaches a nested
+ * call, until the call has been expanded.
+ */
+enum class ExpansionStatus
+{
+    Finished,
+    Suspended,
+    Failed,
+};
 
 /**
  * Declarative Macro.
@@ -42,62 +64,70 @@ struct DeclarativeTemplate
 
     // Ctor.
     //
-    // Constructs and returns a new declartive template with the given name and body.
+    // Constructs and returns a new declartive template with the given name and body. The
+    // parameters and the identifiers of the body are interned in the symbol table.
     explicit DeclarativeTemplate(const std::string& name, const std::vector<std::string>& body,
-                                 const std::vector<DeclarativeMacroParameter>& parameters)
+                                 const std::vector<DeclarativeMacroParameter>& parameters,
+                                 SymbolTable&                                  symbols)
         : m_name(name)
         , m_params(parameters)
     {
+        for (auto& param : m_params)
+        {
+            param.intern(symbols);
+            m_has_literals = m_has_literals || param.has_literals();
+        }
+        m_matcher = DeclarativeMatcher(m_params);
+
         for (const auto& s : body)
         {
             m_token_stream.push_back(macten::TokenStream<MactenAllToken>::from_string(s));
+            m_token_stream.back().intern_symbols(symbols);
+        }
+
+        for (std::size_t index{0}; index < m_token_stream.size() && index < m_params.size(); index++)
+        {
+            m_plans.emplace_back(m_token_stream[index], m_params[index]);
         }
     }
 
-    // Apply declarative template macro, the expansion is written to a target token stream.
-    [[nodiscard]] auto apply(macten::MactenWriter* env, const int index,
-                             macten::TokenStream<MactenAllToken>& target,
-                             std::map<std::string, std::string>   args = {}) const -> bool;
+    // Apply the arm the frame matched, from the step the frame is at. The expansion is written to
+    // the target of the frame. Returns Suspended if a nested call was pushed on the expansion
+    // stack, the frame is then resumed once the call has been expanded.
+    [[nodiscard]] auto apply(macten::MactenWriter* env, ExpansionFrame& frame) const -> ExpansionStatus;
 
     /**
-     * Returns an argument to argument name match. If the argument match fails, none is returned.
+     * The arm which matched a call, and the arguments bound to its parameter names.
      */
-    [[nodiscard]] auto map_args(
-        std::size_t                                           index,
-        macten::TokenStream<MactenAllToken>::TokenStreamView& arg_all_tokens_view) const noexcept
-        -> std::optional<std::map<std::string, std::string>>
+    struct MatchedArm
     {
-        const auto& param = m_params.at(index);
-        return param.map_args(arg_all_tokens_view);
-    }
+        int         index;
+        ArgumentEnvironment args;
+    };
 
     /**
-     * Check arity. Returns true if the arguments supplied count is the same as parameter count.
+     * Match the arguments against all arms and bind them to the parameter names of the first arm
+     * which matches, in a single pass. The view is moved past the arguments the arm took, the
+     * bindings are allocated from `arena`. If no arm matches, none is returned.
+     *
+     * Variadic tails are looked up in `known`, and recorded in `repetitions`, see
+     * DeclarativeMatcher::match().
      */
-    [[nodiscard]] auto check_arity(const std::map<std::string, std::string> args,
-                                   const DeclarativeMacroParameter&         param) -> bool
+    [[nodiscard]] auto match(macten::TokenStream<MactenAllToken>::TokenStreamView& view,
+                             std::pmr::memory_resource* arena, const VariadicRepetitions* known,
+                             VariadicRepetitions& repetitions) const -> std::optional<MatchedArm>
     {
-        return (param.pattern_mode == DeclarativeMacroParameter::PatternMode::Normal &&
-                args.size() != param.argument_names.size());
-    }
+        std::pmr::vector<ArgumentSpan> captures{arena};
 
-    /**
-     * Try matching input against all patterns inside the environment and returns the corresponding
-     * macro index.
-     */
-    [[nodiscard]] auto match(macten::TokenStream<MactenToken>::TokenStreamView view) const noexcept
-        -> int
-    {
-        auto size = static_cast<int>(m_params.size());
-        for (int index{0}; index < size; index++)
+        const auto matched = m_matcher.match(m_params, view, captures, known, repetitions);
+        if (matched.arm == -1)
         {
-            const auto& param = m_params[index];
-            if (param.match(view))
-            {
-                return index;
-            }
+            return {};
         }
-        return -1;
+
+        auto args = m_params[matched.arm].bind(*view.target(), captures, arena);
+        view.advance(matched.end - view.position());
+        return MatchedArm{matched.arm, std::move(args)};
     }
 
     /**
@@ -106,13 +136,23 @@ struct DeclarativeTemplate
     std::string                                      m_name;
     std::vector<DeclarativeMacroParameter>           m_params;
     std::vector<macten::TokenStream<MactenAllToken>> m_token_stream;
+
+    // True if any pattern contains identifiers or numbers, so the symbols of the arguments are
+    // needed for matching.
+    bool m_has_literals{false};
+
+    // The arms of m_params, compiled.
+    DeclarativeMatcher m_matcher;
+
+    // The bodies of m_token_stream, compiled. A plan refers to the body of its arm by index.
+    std::vector<SubstitutionPlan> m_plans;
 };
 
 struct DeclarativeMacroDetail
 {
-    auto construct_template() const -> DeclarativeTemplate
+    auto construct_template(SymbolTable& symbols) const -> DeclarativeTemplate
     {
-        return DeclarativeTemplate(m_name, m_body, m_params);
+        return DeclarativeTemplate(m_name, m_body, m_params, symbols);
     }
 
     /**
@@ -124,6 +164,139 @@ struct DeclarativeMacroDetail
 };
 
 
+/**
+ * The tokens [begin, end) of a stream.
+ */
+struct ExpandedRange
+{
+    std::size_t begin{0};
+    std::size_t end{0};
+};
+
+/**
+ * How far a rescan for macro calls has got through its source, see
+ * MactenWriter::apply_macro_rules(). The top token, the start of the run of tokens not appended
+ * to the target yet, the first expanded range which does not end before the top token, and the
+ * tokens since the last line break, as ranges of the source.
+ */
+struct RescanProgress
+{
+    explicit RescanProgress(std::pmr::memory_resource* arena)
+        : prefix{arena}
+    {
+    }
+
+    std::size_t                     position{0};
+    std::size_t                     run_begin{0};
+    std::size_t                     next_expanded{0};
+    std::pmr::vector<ExpandedRange> prefix;
+};
+
+/**
+ * A call of a declarative macro whose expansion is in progress.
+ *
+ * Nested calls are not expanded by recursion on the native stack. The writer keeps a stack of
+ * frames: a frame is suspended when its body reaches a nested call, or when the rescan of its
+ * pending tokens finds a call, and resumed once the frame pushed for the call has finished. The
+ * depth of a recursive macro is only limited by memory. See MactenWriter::match_and_execute_macro().
+ *
+ * Calls in the arguments of a call are expanded as the arguments are substituted, by recursion,
+ * which is bounded by the nesting of the source.
+ *
+ * The arguments of a call are kept until it has finished. Arguments which are assembled, or
+ * substituted into tokens the rescan finds a call in, are copies: a recursion which passes its
+ * tail on that way, e.g. through `caller![rmin, ($y)]`, takes memory quadratic in its depth.
+ * Sharing them would take views over ropes of several streams. The README points users at the
+ * direct recursion instead.
+ *
+ * The tokens a frame substitutes are collected in `pending` and rescanned for macro calls into
+ * its target. The expansion of a nested call is already rescanned, so when the pending tokens can
+ * be rescanned on their own, they are flushed and the call expands straight into the target. Only
+ * the last tokens of such an expansion are taken back into `pending`, in case they form a macro
+ * call with the tokens after it. Otherwise the call expands into `pending`, to be rescanned with
+ * the tokens around it.
+ */
+struct ExpansionFrame
+{
+    using Stream = macten::TokenStream<MactenAllToken>;
+
+    ExpansionFrame(Symbol macro, const DeclarativeTemplate& rule, Stream& target, Stream::View args)
+        : macro{macro}
+        , rule{&rule}
+        , target{&target}
+        , args{args}
+    {
+    }
+
+    ExpansionFrame(const ExpansionFrame&)                    = delete;
+    auto operator=(const ExpansionFrame&) -> ExpansionFrame& = delete;
+
+    /**
+     * Returns the repetitions of variadic tails known to this frame, for the calls it makes.
+     */
+    [[nodiscard]] auto known() const noexcept -> const VariadicRepetitions*
+    {
+        return repetitions.empty() ? known_repetitions : &repetitions;
+    }
+
+    // Size of the temporaries of a frame which are allocated without touching the heap.
+    static constexpr std::size_t storage_size{256};
+
+    /**
+     * Members.
+     */
+    Symbol                     macro;
+    const DeclarativeTemplate* rule;
+
+    // The stream the expansion is written to, and the arguments which have not been matched yet.
+    Stream*      target;
+    Stream::View args;
+
+    // Temporaries of the expansion, e.g. the argument bindings.
+    std::array<std::byte, storage_size> storage;
+    std::pmr::monotonic_buffer_resource arena{storage.data(), storage.size()};
+
+    // The arm being applied, the step of its plan to apply next, and where its expansion starts
+    // in the target.
+    std::optional<DeclarativeTemplate::MatchedArm> arm;
+    std::size_t                                    step{0};
+    std::size_t                                    arm_begin{0};
+
+    // Ranges of the pending tokens which are expansions already, in order. They are not rescanned
+    // again, see MactenWriter::apply_macro_rules().
+    std::pmr::vector<ExpandedRange> expanded{&arena};
+
+    // Substituted tokens waiting to be rescanned, the arguments of the nested call in progress
+    // if they had to be assembled, and the arguments with their symbols resolved if they had to be
+    // copied for it. Lent by the writer when needed.
+    std::unique_ptr<Stream> pending;
+    std::unique_ptr<Stream> nested_args;
+    std::unique_ptr<Stream> resolved_args;
+
+    // Where the expansion of the nested call in progress starts in its target, and whether that
+    // target is `target` rather than `pending`.
+    std::size_t call_begin{0};
+    bool        streamed{false};
+
+    // The rescan of the pending tokens, while it is suspended at a call it found.
+    std::optional<RescanProgress> rescan;
+
+    // Repetitions of the variadic tail this frame matched, and those its callers know of.
+    VariadicRepetitions        repetitions{&arena};
+    const VariadicRepetitions* known_repetitions{nullptr};
+
+    // Memoization. The key of the call, empty if the call bypasses the cache, where the expansion
+    // starts in the target, and the number of procedural calls made before it.
+    std::pmr::string key{&arena};
+    std::size_t      target_begin{0};
+    std::size_t      procedural_calls{0};
+
+    // Statistics, only kept when they are collected. When the expansion started, and the time
+    // spent in the calls it made.
+    RunStats::Clock::time_point started{};
+    RunStats::Duration          nested_time{};
+};
+
 /**
  * Parser.
  */
@@ -134,10 +307,11 @@ struct DeclarativeMacroDetail
 class MactenWriter
 {
   private:
-    using DeclarativeMacroRules = std::unordered_map<std::string, DeclarativeTemplate>;
-    using ProceduralMacroRules  = std::unordered_set<std::string>;
+    // The registries are indexed by the symbol of the macro name. Symbols of other names are
+    // past the end, or have an empty entry.
+    using DeclarativeMacroRules = std::vector<std::optional<DeclarativeTemplate>>;
+    using ProceduralMacroRules  = std::vector<bool>;
     using TType                 = MactenAllToken;
-    inline static const std::map<std::string, std::string> EmptyArgList{};
 
   public:
     explicit MactenWriter(std::string_view path, std::string_view output_name)
@@ -157,131 +331,374 @@ class MactenWriter
         {
             std::for_each(parser.m_macros.begin(), parser.m_macros.end(),
                           [this](const auto& macro_detail) {
-                              m_declarative_macro_rules[macro_detail.m_name] =
-                                  macro_detail.construct_template();
+                              const auto symbol = m_symbols.intern(macro_detail.m_name);
+                              if (symbol >= m_declarative_macro_rules.size())
+                                  m_declarative_macro_rules.resize(symbol + 1);
+                              m_declarative_macro_rules[symbol] =
+                                  macro_detail.construct_template(m_symbols);
                           });
             std::for_each(parser.m_prod_macros.begin(), parser.m_prod_macros.end(),
                           [this](const auto& prod_macro_name) {
-                              m_procedural_macro_rules.insert(prod_macro_name);
+                              const auto symbol = m_symbols.intern(prod_macro_name);
+                              if (symbol >= m_procedural_macro_rules.size())
+                                  m_procedural_macro_rules.resize(symbol + 1);
+                              m_procedural_macro_rules[symbol] = true;
                           });
         }
         return res;
     }
 
+    /**
+     * Collect the statistics of the run into `stats`, see RunStats. Nothing is collected if it
+     * is null.
+     */
+    auto collect_stats(RunStats* stats) noexcept -> void
+    {
+        m_stats = stats;
+    }
+
+    /**
+     * Returns the symbols of the macro names, to name the macros of the statistics.
+     */
+    [[nodiscard]] auto symbols() const noexcept -> const SymbolTable&
+    {
+        return m_symbols;
+    }
+
+    /**
+     * Inline the calls in declarative macro bodies whose expansion is the same on every
+     * invocation, so invoking the caller does not expand them again.
+     *
+     * A call is inlined if its arguments are literal, so the arm it matches is known, and its
+     * callee does not reach a cycle in the call graph of the macros. It is expanded once, here,
+     * and its expansion is inserted as a memoized expansion of the call would be, so the output
+     * does not change. Calls whose expansion fails, calls a procedural macro, or is longer than
+     * inline_max_tokens are left as they are. Callees are visited before their callers, so a
+     * chain of such calls collapses into the expansion of the first one.
+     */
+    auto inline_declarative_calls() -> void
+    {
+        std::vector<CallGraphState> states(m_declarative_macro_rules.size(), CallGraphState::Unvisited);
+        std::vector<Symbol>         order{};
+
+        for (Symbol macro{0}; macro < m_declarative_macro_rules.size(); macro++)
+        {
+            visit_call_graph(macro, states, order);
+        }
+
+        for (const auto macro : order)
+        {
+            auto& rule = *m_declarative_macro_rules[macro];
+            for (std::size_t arm{0}; arm < rule.m_plans.size(); arm++)
+            {
+                auto&       plan = rule.m_plans[arm];
+                const auto& body = rule.m_token_stream[arm];
+
+                // Follow the steps as an expansion would, past the calls which are expanded.
+                for (std::size_t index{0}; index < plan.steps().size();)
+                {
+                    const auto step = plan.steps()[index];
+                    if (step.kind != SubstitutionPlan::StepKind::Call)
+                    {
+                        index++;
+                        continue;
+                    }
+
+                    if (!has_declarative_macro(step.macro))
+                    {
+                        index = step.arguments_end;
+                        continue;
+                    }
+
+                    if (states[step.macro] == CallGraphState::Acyclic && plan.has_literal_arguments(index))
+                    {
+                        if (auto expansion = expand_ahead(body, plan, index); expansion.has_value())
+                        {
+                            plan.inline_call(index, std::move(*expansion));
+                        }
+                    }
+                    index = step.next;
+                }
+            }
+        }
+    }
+
     /**
      * Checks wheter the macro with the given name exists as a declarative macro.
      */
-    auto has_declarative_macro(const std::string& name) -> bool
+    auto has_declarative_macro(std::string_view name) -> bool
     {
-        return m_declarative_macro_rules.contains(name);
+        return has_declarative_macro(m_symbols.find(name));
+    }
+
+    auto has_declarative_macro(Symbol symbol) -> bool
+    {
+        return symbol < m_declarative_macro_rules.size() && m_declarative_macro_rules[symbol].has_value();
     }
 
 
     /**
      * Checks wheter the macro with the given name exists as a procedural macro.
      */
-    auto has_procedural_macro(const std::string& name) -> bool
+    auto has_procedural_macro(std::string_view name) -> bool
+    {
+        return has_procedural_macro(m_symbols.find(name));
+    }
+
+    auto has_procedural_macro(Symbol symbol) -> bool
     {
-        return m_procedural_macro_rules.contains(name);
+        return symbol < m_procedural_macro_rules.size() && m_procedural_macro_rules[symbol];
     }
 
     /**
-     * Apply macro rules.
+     * Apply macro rules. Temporaries are allocated from `arena`, which is the arena of the
+     * enclosing invocation during an expansion.
+     *
+     * The target is a token stream or a token rope. Runs of tokens which pass through unchanged
+     * are appended as ranges of the source stream, which a rope shares instead of copying.
+     *
+     * `expanded` lists ranges of the source, in order, which have already been rescanned, such as
+     * substituted arguments. They are passed on without looking for macro calls in them again,
+     * except for their last two tokens, which may start a call or a join with the tokens after
+     * them.
      */
-    auto apply_macro_rules(macten::TokenStream<MactenAllToken>&                  target,
-                           macten::TokenStream<MactenAllToken>::TokenStreamView& source_view)
+    template <typename Target>
+    auto apply_macro_rules(Target&                                               target,
+                           macten::TokenStream<MactenAllToken>::TokenStreamView& source_view,
+                           std::pmr::memory_resource* arena    = std::pmr::get_default_resource(),
+                           std::span<const ExpandedRange>   expanded = {})
         -> bool
 
     {
-        std::vector<TType> prefix_buffer{};
+        RescanProgress progress{arena};
+        progress.run_begin = source_view.position();
+        return rescan(target, source_view, progress, arena, expanded, nullptr) == ExpansionStatus::Finished;
+    }
+
+    /**
+     * Rescan the source for macro calls from `progress` on, see apply_macro_rules().
+     *
+     * Declarative calls are expanded at once, unless the rescan is the flush of `frame`. Then a
+     * frame is pushed for the call, the progress is saved, and Suspended is returned; the rescan is
+     * continued once the call has finished, see flush().
+     */
+    template <typename Target>
+    auto rescan(Target&                                               target,
+                macten::TokenStream<MactenAllToken>::TokenStreamView& source_view,
+                RescanProgress&                                       progress,
+                std::pmr::memory_resource*                            arena,
+                std::span<const ExpandedRange>                        expanded,
+                ExpansionFrame*                                       frame) -> ExpansionStatus
+    {
+        // Reused to build the indentation of each procedural macro call.
+        std::pmr::string indent{arena};
+
+        const auto& source        = *source_view.target();
+        auto&       run_begin     = progress.run_begin;
+        auto&       next_expanded = progress.next_expanded;
+        auto&       prefix_buffer = progress.prefix;
 
         while (!source_view.peek().is(MactenAllToken::EndOfFile))
         {
+            const auto token_index = source_view.position();
+
+            while (next_expanded < expanded.size() && expanded[next_expanded].end <= token_index + 2)
+            {
+                next_expanded++;
+            }
+
+            if (next_expanded < expanded.size() && expanded[next_expanded].begin <= token_index)
+            {
+                // An EndOfFile token still ends the scan.
+                const auto skip_end =
+                    std::min(expanded[next_expanded].end - 2, source.next_end_of_file(token_index));
+                if (skip_end > token_index)
+                {
+                    prefix_buffer.push_back({token_index, skip_end});
+                    source_view.advance(skip_end - token_index);
+                    continue;
+                }
+            }
+
             auto token = source_view.peek();
+            bool joined{false};
 
             while (source_view.match_sequence(TType::Identifier, TType::Underscore))
             {
+                joined = true;
                 if (source_view.peek(2).is(TType::Identifier))
                 {
-                    token.lexeme += "_" + source_view.peek(2).lexeme;
+                    token = utils::join_tokens(target, token, source_view.peek(1));
+                    token = utils::join_tokens(target, token, source_view.peek(2));
                     source_view.advance(2);
                 }
                 else
                 {
                     while (source_view.peek(1).is(TType::Underscore))
                     {
-                        token.lexeme += "_";
+                        token = utils::join_tokens(target, token, source_view.peek(1));
                         source_view.advance(1);
                     }
                 }
             }
 
             const bool macro_call_found = macten::utils::is_macro_call(source_view);
+            bool       suspended{false};
 
             if (macro_call_found)
             {
-                std::stringstream indent_ss{};
-                for (const auto& prefix : prefix_buffer)
-                    indent_ss << prefix.get_symbol();
-                const std::string indent = indent_ss.str();
+                target.append(source, run_begin, token_index);
+
+                const auto macro = m_symbols.find(token.lexeme);
 
-                if (has_declarative_macro(token.lexeme)) 
+                if (has_declarative_macro(macro)) 
                 {
                     // Move onto the '['.
                     source_view.skip_until(TType::LSquare);
                     if (!source_view.consume(TType::LSquare))
-                        return false;
+                        return ExpansionStatus::Failed;
 
                     const auto args = source_view.between(MactenAllToken::LSquare, MactenAllToken::RSquare);
                     source_view.advance(args.remaining_size());
 
-                    if (!match_and_execute_macro(target, token.lexeme, args.construct()))
+                    auto status = ExpansionStatus::Failed;
+                    if constexpr (std::is_same_v<Target, macten::TokenStream<MactenAllToken>>)
+                    {
+                        if (frame != nullptr)
+                        {
+                            status = begin_call(target, macro, args, nullptr);
+                        }
+                    }
+                    if (frame == nullptr)
+                    {
+                        const bool success = write_expansion(target, [&](auto& expansion) {
+                            return match_and_execute_macro(expansion, macro, args);
+                        });
+                        status = success ? ExpansionStatus::Finished : ExpansionStatus::Failed;
+                    }
+
+                    if (status == ExpansionStatus::Failed)
                     {
-                        return false;
+                        return status;
                     }
+                    suspended = status == ExpansionStatus::Suspended;
                 }
-                else if (has_procedural_macro(token.lexeme))
+                else if (has_procedural_macro(macro))
                 {
-                    if (!handle_procedural_macro_call(target, token.lexeme, source_view, indent)) 
+                    // Its output may differ on every call, so it is never run ahead of time.
+                    if (m_expanding_ahead)
+                    {
+                        m_ahead_failed = true;
+                        return ExpansionStatus::Failed;
+                    }
+
+                    build_indent(indent, source, prefix_buffer);
+                    const bool success = write_expansion(target, [&](auto& expansion) {
+                        return handle_procedural_macro_call(expansion, token.lexeme, source_view, indent);
+                    });
+                    if (!success) 
                     {
-                        return false;
+                        return ExpansionStatus::Failed;
                     }
                 }
+
+                run_begin = source_view.position() + 1;
             }
             else
             {
                 if (token.type == TType::Newline)
                     prefix_buffer.clear();
                 else
-                    prefix_buffer.push_back(token.type);
+                    prefix_buffer.push_back({token_index, token_index + 1});
 
-                // Default. Just push the token, no need to care.
-                target.push_back(token);
+                // Default. Just pass the token on, joined tokens replace the run they span.
+                if (joined)
+                {
+                    target.append(source, run_begin, token_index);
+                    target.push_back(token);
+                    run_begin = source_view.position() + 1;
+                }
             }
 
             source_view.advance();
+
+            if (suspended)
+            {
+                progress.position = source_view.position();
+                return ExpansionStatus::Suspended;
+            }
         }
 
+        target.append(source, run_begin, source_view.position());
 
-        return true;
+        return ExpansionStatus::Finished;
+    }
+
+    /**
+     * Build the indentation of a macro call from the tokens before it on its line, given as
+     * ranges of the source by apply_macro_rules(). Expanded ranges were not checked for line
+     * breaks, only their tokens after the last one count.
+     */
+    template <typename String>
+    static auto build_indent(String& indent, const macten::TokenStream<MactenAllToken>& source,
+                             std::span<const ExpandedRange> prefix) -> void
+    {
+        indent.clear();
+        for (const auto& range : prefix)
+        {
+            auto from = range.begin;
+            for (auto index = range.end; index > range.begin; --index)
+            {
+                if (source.type_at(index - 1) == TType::Newline)
+                {
+                    indent.clear();
+                    from = index;
+                    break;
+                }
+            }
+
+            for (auto index = from; index < range.end; ++index)
+                indent.append(source.type_at(index).get_symbol());
+        }
+    }
+
+    /**
+     * Let `write` write an expansion into the target. A rope receives the expansion in a stream
+     * of its own and splices it in.
+     */
+    template <typename Write>
+    static auto write_expansion(macten::TokenStream<MactenAllToken>& target, Write&& write) -> bool
+    {
+        return write(target);
+    }
+
+    template <typename Write>
+    static auto write_expansion(macten::TokenRope<MactenAllToken>& target, Write&& write) -> bool
+    {
+        return target.splice(std::forward<Write>(write));
     }
 
     auto handle_procedural_macro_call(
                                       macten::TokenStream<MactenAllToken>& target,
-                                      const std::string& macro_name, 
+                                      std::string_view macro_name, 
                                       macten::TokenStream<MactenAllToken>::TokenStreamView& source_view,
-                                      const std::string& indent) -> bool
+                                      std::string_view indent) -> bool
     {
+        const auto started      = stats_clock();
+        const auto target_begin = target.size();
+
         // Capture argument body [arg].
         source_view.skip_until(TType::LSquare);
         if (!source_view.consume(TType::LSquare)) return false;
         const auto args = source_view.between(MactenAllToken::LSquare, MactenAllToken::RSquare);
         source_view.advance(args.remaining_size());
 
+        m_procedural_calls++;
+
         // Dump the arguments into a file.
         std::ofstream tmp_file{};
         tmp_file.open(".macten/tmp.in");
-        tmp_file << args.construct();
+        args.write_to(tmp_file);
         tmp_file.close();
 
         // Set up fork & exec.
@@ -295,7 +712,8 @@ class MactenWriter
         {
             // Child process
            const char executable[] = "/home/linuxbrew/.linuxbrew/bin/python3";
-           execl(executable, executable, ".macten/driver.py", macro_name.c_str(), ".macten/tmp.in",  NULL);
+           const std::string macro_name_str(macro_name);
+           execl(executable, executable, ".macten/driver.py", macro_name_str.c_str(), ".macten/tmp.in",  NULL);
         }
 
         const auto result_stream = macten::TokenStream<MactenAllToken>::from_file_raw(".macten/tmp.in.out");
@@ -311,83 +729,170 @@ class MactenWriter
             }
         }
 
+        if (m_stats != nullptr) [[unlikely]]
+        {
+            const auto time = RunStats::Clock::now() - started;
+            m_stats->procedural_call(m_symbols.find(macro_name), time, target.size() - target_begin);
+            if (!m_frames.empty())
+            {
+                m_frames.back().nested_time += time;
+            }
+        }
+
         return true;
     }
 
-    auto match_and_execute_macro(macten::TokenStream<MactenAllToken>& target,
-                                 const std::string& macro_name, const std::string& args) -> bool
+    /**
+     * Expand a call of the declarative macro with the symbol `macro` into the target stream. The
+     * arguments are the tokens of the view, which is the inside of the call's brackets. They are
+     * matched and substituted in place, so the stream they belong to must outlive the call.
+     *
+     * Nested calls are expanded on the expansion stack, see ExpansionFrame. A nested call whose
+     * arguments are a single argument of its caller, such as the tail of a recursive variadic
+     * macro, views them in place, so each level of the recursion works on a shorter view of the
+     * same tokens.
+     */
+    auto match_and_execute_macro(macten::TokenStream<MactenAllToken>& target, Symbol macro,
+                                 macten::TokenStream<MactenAllToken>::TokenStreamView args) -> bool
+    {
+        const auto base = m_frames.size();
+
+        switch (begin_call(target, macro, args, nullptr))
+        {
+            break;
+            case ExpansionStatus::Finished: return true;
+            case ExpansionStatus::Failed: return false;
+            case ExpansionStatus::Suspended: break;
+        }
+
+        return expand_frames(base);
+    }
+
+    /**
+     * Returns the expansion cache, for its statistics.
+     */
+    [[nodiscard]] auto expansion_cache() const noexcept -> const ExpansionCache&
     {
-        const DeclarativeTemplate macro_rule{this->m_declarative_macro_rules.at(macro_name)};
+        return m_expansion_cache;
+    }
 
-        const auto all_token_stream      = macten::TokenStream<MactenAllToken>::from_string(args);
-        auto       all_token_stream_view = all_token_stream.get_view();
+    /**
+     * Decide where the call which the frame has reached is expanded, before its step is applied.
+     * If the pending tokens can be rescanned without the call, they are flushed, and the call is
+     * expanded straight into the target of the frame. Returns Suspended if the flush pushed a frame
+     * for a call it found, the step is applied again once it has finished.
+     */
+    auto prepare_call(ExpansionFrame& frame) -> ExpansionStatus
+    {
+        frame.streamed = frame.pending == nullptr || can_rescan_alone(*frame.pending);
+        return frame.streamed ? flush(frame) : ExpansionStatus::Finished;
+    }
 
-        do
+    /**
+     * Expand the call which the frame has reached, the last step the frame applied, where
+     * prepare_call() decided. Returns Suspended if a frame was pushed for the call.
+     */
+    auto call_macro(ExpansionFrame& frame, Symbol macro,
+                    macten::TokenStream<MactenAllToken>::TokenStreamView args) -> ExpansionStatus
+    {
+        return write_call(frame, [&](auto& call_target) {
+            return begin_call(call_target, macro, args, frame.known());
+        });
+    }
+
+    /**
+     * Insert the expansion of the call which the frame has reached, computed when the macro was
+     * defined. It is written out as a memoized expansion of the call would be.
+     */
+    auto insert_expansion(ExpansionFrame& frame, const macten::TokenStream<MactenAllToken>& expansion) -> void
+    {
+        static_cast<void>(write_call(frame, [&](auto& call_target) {
+            call_target.append(expansion, 0, expansion.size());
+            return ExpansionStatus::Finished;
+        }));
+    }
+
+    /**
+     * Returns the pending tokens of the frame.
+     */
+    auto pending(ExpansionFrame& frame) -> macten::TokenStream<MactenAllToken>&
+    {
+        if (frame.pending == nullptr)
         {
-            const auto token_stream = macten::TokenStream<MactenToken>::from_string(all_token_stream_view.construct());
-            auto token_stream_view = token_stream.get_view();
+            frame.pending = acquire_stream();
+        }
+        return *frame.pending;
+    }
 
-            // Find match.
-            const int idx = macro_rule.match(token_stream_view);
-            if (idx == -1)
-            {
-                return false;
-            }
+    /**
+     * Returns a stream for the arguments of the nested call the frame is about to make, empty.
+     */
+    auto nested_arguments(ExpansionFrame& frame) -> macten::TokenStream<MactenAllToken>&
+    {
+        if (frame.nested_args == nullptr)
+        {
+            frame.nested_args = acquire_stream();
+        }
+        frame.nested_args->reset();
+        return *frame.nested_args;
+    }
 
-            const auto args_mapping = macro_rule.map_args(idx, all_token_stream_view);
+    /**
+     * Rescan the pending tokens of the frame into its target. The declarative calls the rescan
+     * finds are pushed on the expansion stack, and Suspended is returned for each of them. The
+     * frame then flushes again from the same step, which continues the rescan where it stopped.
+     *
+     * A rescan which fails, or finds a call which fails, does not fail the frame: the tokens
+     * after the failure are dropped, see abandon_rescan().
+     */
+    auto flush(ExpansionFrame& frame) -> ExpansionStatus
+    {
+        if (frame.pending == nullptr)
+        {
+            return ExpansionStatus::Finished;
+        }
 
-            if (!args_mapping.has_value())
-            {
-                std::cerr << "Failed to create argument mapping for macro '" << macro_name << "'\n";
-                return false;
-            }
+        if (!frame.rescan.has_value())
+        {
+            frame.rescan.emplace(&frame.arena);
+        }
 
-            const bool success = macro_rule.apply(this, idx, target, args_mapping.value());
-            if (!success)
-            {
-                std::cerr << "Failed to apply macro: '" << macro_name << "'\n";
-                return false;
-            }
+        auto view = frame.pending->get_view();
+        view.advance(frame.rescan->position);
 
-            while (all_token_stream_view.peek().any_of(MactenAllToken::Newline))
-            {
-                target.push_back(all_token_stream_view.pop());
-            }
-            all_token_stream_view.skip(MactenAllToken::Space, MactenAllToken::Newline, MactenAllToken::Tab);
-        } while ((!all_token_stream_view.is_at_end()));
-        return true;
+        const auto status = rescan(*frame.target, view, *frame.rescan, &frame.arena, frame.expanded, &frame);
+        if (status == ExpansionStatus::Suspended)
+        {
+            return status;
+        }
+
+        abandon_rescan(frame);
+        return ExpansionStatus::Finished;
+    }
+
+    /**
+     * End the rescan of the pending tokens of the frame, whether it finished or not. The pending
+     * tokens which were not rescanned yet are dropped.
+     */
+    auto abandon_rescan(ExpansionFrame& frame) -> void
+    {
+        frame.rescan.reset();
+        release_stream(frame.pending);
+        frame.expanded.clear();
     }
 
     /**
      * Skip macro definition. This removes the macten definitions from the source code.
      */
-    auto skip_macro_definition(macten::TokenStream<MactenAllToken>::TokenStreamView& view) -> void
+    template <typename View>
+    auto skip_macro_definition(View& view) -> void
     {
         using TokenType = MactenAllToken;
         view.skip(TokenType::Space, TokenType::Tab, TokenType::Newline, TokenType::Identifier);
 
-        int16_t brace_scope{1};
-
         if (view.consume(TokenType::LBrace))
         {
-            while (!view.is_at_end() && brace_scope > 0)
-            {
-                switch (view.peek().type)
-                {
-                    break;
-                    case TokenType::LBrace:
-                        ++brace_scope;
-                        break;
-                    case TokenType::RBrace:
-                        --brace_scope;
-                        break;
-                    default:
-                    {
-                    }
-                }
-                view.advance();
-            }
-
+            view.skip_scope(TokenType::LBrace, TokenType::RBrace);
             view.skip(TokenType::Space, TokenType::Tab, TokenType::Newline);
         }
     }
@@ -395,8 +900,8 @@ class MactenWriter
     /**
      * Tidy macro call site. This allows for convenient assumptions during the expansion phase.
      */
-    auto tidy_macro_call_site(macten::TokenStream<MactenAllToken>::TokenStreamView& view,
-                              macten::TokenStream<MactenAllToken>&                  target) -> void
+    template <typename View, typename Target>
+    auto tidy_macro_call_site(View& view, Target& target) -> void
     {
         using TokenType = MactenAllToken;
         view.skip(TokenType::Space, TokenType::Tab, TokenType::Newline);
@@ -439,76 +944,193 @@ class MactenWriter
     }
 
     /**
-     * Remove macro definitions from the final generated code.
+     * Remove macro definitions from the final generated code. The result shares the ranges of
+     * the source between definitions and call sites, so the source must outlive it.
      */
-    auto preprocess(macten::TokenStream<MactenAllToken>& source)
-        -> macten::TokenStream<MactenAllToken>
+    auto preprocess(const macten::TokenStream<MactenAllToken>& source)
+        -> macten::TokenRope<MactenAllToken>
     {
-        using TokenType = MactenAllToken;
-
-        macten::TokenStream<MactenAllToken> processed_tokens{};
-        auto                                source_view = source.get_view();
+        macten::TokenRope<MactenAllToken> processed_tokens{};
+        auto                              source_view = source.get_view();
 
         while (!source_view.is_at_end())
         {
-            const auto token = source_view.pop();
-
-            if (token.any_of(TokenType::ProceduralDefinition, TokenType::DeclarativeDefinition))
-            {
-                skip_macro_definition(source_view);
-                continue;
-            }
-            else if (token.is(TokenType::Identifier) &&
-                     m_declarative_macro_rules.contains(token.lexeme) &&
-                     source_view.match_sequence(TokenType::Exclamation, TokenType::LSquare))
-            {
-                processed_tokens.push_back(token);
-                processed_tokens.push_back(source_view.peek(0));
-                processed_tokens.push_back(source_view.peek(1));
-                source_view.advance(2);
-                tidy_macro_call_site(source_view, processed_tokens);
-                continue;
-            }
-
-            processed_tokens.push_back(token);
+            preprocess_next(source_view, processed_tokens);
         }
 
         return processed_tokens;
     }
 
-    [[nodiscard]] auto generate() -> bool
-    {
-        MactenParser parser(m_source_path);
-        return parser.generate_procedural();
-    }
-
     /**
-     * Tokenize. Substitute. Rebuild.
-     * NOTE: At the moment, this requires two passes. This can be addressed later.
+     * Preprocess the next token, or the whole definition or macro call site it starts.
+     * Only moves forward through the source, so it works on lazy streams as well as views.
      */
-    auto process() -> bool
+    template <typename View, typename Target>
+    auto preprocess_next(View& source_view, Target& processed_tokens) -> void
     {
-        // Generate parse rules.
-        // This is the first pass.
-        generate_declarative_rules();
-
-        // Tokenize the file.
-        macten::TokenStream<MactenAllToken> result_tokens;
-        auto source_tokens = macten::TokenStream<MactenAllToken>::from_file(m_source_path);
-
-        // Preprocess and remove definitions.
-        source_tokens = preprocess(source_tokens);
+        using TokenType = MactenAllToken;
 
-        // Note: It's important that we get the view AFTER preprocess.
-        auto       source_tokens_view = source_tokens.get_view();
-        const auto res                = apply_macro_rules(result_tokens, source_tokens_view);
+        const auto token = source_view.peek();
+
+        if (token.any_of(TokenType::ProceduralDefinition, TokenType::DeclarativeDefinition))
+        {
+            source_view.advance();
+            skip_macro_definition(source_view);
+            return;
+        }
+        else if (token.is(TokenType::Identifier) &&
+                 has_declarative_macro(token.lexeme) &&
+                 source_view.peek(1).is(TokenType::Exclamation) &&
+                 source_view.peek(2).is(TokenType::LSquare))
+        {
+            processed_tokens.push_back(token);
+            processed_tokens.push_back(source_view.peek(1));
+            processed_tokens.push_back(source_view.peek(2));
+            source_view.advance(3);
+            tidy_macro_call_site(source_view, processed_tokens);
+            return;
+        }
+
+        pass_token(source_view, processed_tokens);
+    }
+
+    /**
+     * Move the next token of the source to the target unchanged. A rope shares the token's
+     * slice of the source stream instead of copying it.
+     */
+    template <typename View>
+    static auto pass_token(View& source_view, macten::TokenStream<MactenAllToken>& target) -> void
+    {
+        target.push_back(source_view.pop());
+    }
+
+    static auto pass_token(macten::TokenStream<MactenAllToken>::TokenStreamView& source_view,
+                           macten::TokenRope<MactenAllToken>&                    target) -> void
+    {
+        const auto index = source_view.position();
+        target.append(*source_view.target(), index, index + 1);
+        source_view.advance();
+    }
+
+    [[nodiscard]] auto generate() -> bool
+    {
+        MactenParser parser(m_source_path);
+        return parser.generate_procedural();
+    }
+
+    /**
+     * Tokenize. Substitute. Rebuild.
+     *
+     * The definitions are collected in a first pass. The source is then scanned lazily and
+     * preprocessed into segments which end on a line break outside of any macro call, each
+     * segment is expanded and written out before more of the source is scanned. Memory stays
+     * bounded by the largest segment rather than by the size of the file.
+     */
+    auto process() -> bool
+    {
+        const auto started = stats_clock();
+
+        // Generate parse rules.
+        // This is the first pass.
+        generate_declarative_rules();
+        inline_declarative_calls();
+
+        if (m_stats != nullptr) [[unlikely]]
+        {
+            auto& definitions = m_stats->phase(RunStats::Phase::DefinitionParse);
+            definitions.time  = RunStats::Clock::now() - started;
+            for (const auto& rule : m_declarative_macro_rules)
+            {
+                if (!rule.has_value())
+                    continue;
+                for (const auto& body : rule->m_token_stream)
+                    definitions.tokens += body.size();
+            }
+        }
 
-        // Write to output file
         std::ofstream output_file;
         output_file.open(m_output_name);
-        output_file << result_tokens.construct();
-        output_file.close();
 
+        const auto processing_started = stats_clock();
+
+        auto source = macten::LazyTokenStream<MactenAllToken>::from_file(m_source_path, stream_chunk_size);
+
+        macten::LazyTokenStream<MactenAllToken>::ScanStats scan_stats{};
+        if (m_stats != nullptr) [[unlikely]]
+        {
+            source.collect_stats(&scan_stats);
+        }
+
+        SegmentTracker                      tracker{};
+        macten::TokenStream<MactenAllToken> segment{};
+        bool                                success{true};
+
+        while (success && !source.is_at_end())
+        {
+            const auto processed_from = segment.size();
+            preprocess_next(source, segment);
+            source.release_consumed();
+
+            bool can_split{false};
+            for (auto index = processed_from; index < segment.size(); ++index)
+            {
+                can_split = tracker.update(segment.at(index));
+            }
+
+            if (can_split && segment.size() >= stream_segment_size)
+            {
+                success = expand_segment(segment, output_file);
+
+                // Drop the segment, releasing the source windows it pinned.
+                segment = {};
+            }
+        }
+
+        success = success && expand_segment(segment, output_file);
+
+        if (m_stats != nullptr) [[unlikely]]
+        {
+            auto& scan       = m_stats->phase(RunStats::Phase::Scan);
+            auto& preprocess = m_stats->phase(RunStats::Phase::Preprocess);
+            auto& expansion  = m_stats->phase(RunStats::Phase::Expansion);
+            auto& write      = m_stats->phase(RunStats::Phase::OutputWrite);
+            scan.time        = scan_stats.time;
+            scan.tokens      = scan_stats.tokens;
+
+            // The source is scanned as it is preprocessed, and segments are expanded and written
+            // in between, preprocessing took the rest. Procedural calls are made by the expansion.
+            preprocess.time = RunStats::Clock::now() - processing_started - scan.time - expansion.time - write.time;
+            expansion.time -= m_stats->phase(RunStats::Phase::ProceduralCalls).time;
+        }
+
+        return success;
+    }
+
+    /**
+     * Expand a preprocessed segment and write the result to the output. The result shares the
+     * ranges of the segment around macro calls, and is only flattened as it is written.
+     */
+    auto expand_segment(const macten::TokenStream<MactenAllToken>& segment, std::ostream& output) -> bool
+    {
+        macten::TokenRope<MactenAllToken> result_tokens;
+
+        const auto started      = stats_clock();
+        auto       segment_view = segment.get_view();
+        const auto res          = apply_macro_rules(result_tokens, segment_view);
+        const auto expanded     = stats_clock();
+
+        result_tokens.write_to(output);
+
+        if (m_stats != nullptr) [[unlikely]]
+        {
+            auto& expansion = m_stats->phase(RunStats::Phase::Expansion);
+            auto& write     = m_stats->phase(RunStats::Phase::OutputWrite);
+            expansion.time += expanded - started;
+            expansion.tokens += result_tokens.size();
+            write.time += RunStats::Clock::now() - expanded;
+            write.tokens += result_tokens.size();
+            m_stats->phase(RunStats::Phase::Preprocess).tokens += segment.size();
+        }
         return res;
     }
 
@@ -521,10 +1143,525 @@ class MactenWriter
     }
 
   private:
+    /**
+     * Let `call` write the expansion of the call which the frame has reached, into the target of
+     * the frame if the pending tokens could be rescanned without it, into the pending tokens
+     * otherwise. See prepare_call().
+     */
+    template <typename Call>
+    auto write_call(ExpansionFrame& frame, Call&& call) -> ExpansionStatus
+    {
+        auto& call_target = frame.streamed ? *frame.target : pending(frame);
+        frame.call_begin  = call_target.size();
+
+        const auto status = call(call_target);
+        if (status == ExpansionStatus::Finished)
+        {
+            resume(frame);
+        }
+        return status;
+    }
+
+    /**
+     * Start expanding a call of the declarative macro into the target. A memoized expansion is
+     * written out at once, otherwise a frame is pushed for the call and Suspended is returned.
+     * `known` holds the repetitions of variadic tails known to the caller.
+     *
+     * Expansions are memoized in the expansion cache. A macro whose expansion called a procedural
+     * macro bypasses the cache from then on, its expansion depends on more than its arguments.
+     * So do calls with long arguments, building their key would cost as much as expanding them.
+     */
+    auto begin_call(macten::TokenStream<MactenAllToken>& target, Symbol macro,
+                    macten::TokenStream<MactenAllToken>::TokenStreamView args,
+                    const VariadicRepetitions* known) -> ExpansionStatus
+    {
+        if (m_expanding_ahead && ++m_ahead_calls > inline_max_calls)
+        {
+            m_ahead_failed = true;
+            return ExpansionStatus::Failed;
+        }
+
+        if (m_stats != nullptr) [[unlikely]]
+        {
+            m_stats->call(macro, m_declarative_macro_rules[macro]->m_params.size());
+        }
+
+        const bool cached = !(macro < m_uncached_macros.size() && m_uncached_macros[macro]) &&
+                            args.remaining_size() <= expansion_key_max_tokens;
+
+        // Keys of typical calls fit on the stack.
+        std::array<std::byte, expansion_key_size> key_storage;
+        std::pmr::monotonic_buffer_resource      key_arena{key_storage.data(), key_storage.size()};
+        std::pmr::string                         key{&key_arena};
+
+        if (cached)
+        {
+            ExpansionCache::make_key(key, macro, args);
+            if (const auto* expansion = m_expansion_cache.find(key); expansion != nullptr)
+            {
+                target.append(*expansion, 0, expansion->size());
+                if (m_stats != nullptr) [[unlikely]]
+                {
+                    m_stats->cache_hit(macro, expansion->size());
+                }
+                return ExpansionStatus::Finished;
+            }
+        }
+        else
+        {
+            m_expansion_cache.bypass();
+        }
+
+        // The registry is not modified during expansion, so the rule is used in place.
+        const DeclarativeTemplate& macro_rule{*m_declarative_macro_rules[macro]};
+
+        // Pattern literals are compared by symbol. Arguments without symbols are copied token by
+        // token into a stream of the frame to record them, others are used in place.
+        std::unique_ptr<macten::TokenStream<MactenAllToken>> resolved_args{};
+        if (macro_rule.m_has_literals && !args.target()->has_symbols(args.size()))
+        {
+            resolved_args = acquire_stream();
+            resolved_args->append(*args.target(), args.position(), args.position() + args.remaining_size());
+            resolved_args->resolve_symbols(m_symbols);
+        }
+
+        auto& frame = m_frames.emplace_back(macro, macro_rule, target,
+                                            resolved_args != nullptr ? resolved_args->get_view() : args);
+        frame.resolved_args     = std::move(resolved_args);
+        frame.known_repetitions = known;
+        frame.target_begin      = target.size();
+        frame.procedural_calls  = m_procedural_calls;
+        if (cached)
+        {
+            frame.key.assign(key);
+        }
+        if (m_stats != nullptr) [[unlikely]]
+        {
+            frame.started = RunStats::Clock::now();
+            m_stats->enter(macro);
+        }
+        return ExpansionStatus::Suspended;
+    }
+
+    /**
+     * Returns the current time if statistics are collected.
+     */
+    [[nodiscard]] auto stats_clock() const -> RunStats::Clock::time_point
+    {
+        return m_stats != nullptr ? RunStats::Clock::now() : RunStats::Clock::time_point{};
+    }
+
+    /**
+     * Expand the frames above `base` on the expansion stack, until they have all finished.
+     *
+     * When a frame fails, the frames are unwound down to the call which the innermost rescan in
+     * progress found, if there is one above `base`, and that rescan is abandoned. Its frame goes
+     * on, as a call in rescanned tokens which fails does not fail the expansion around it.
+     * Otherwise every frame above `base` is unwound.
+     */
+    auto expand_frames(std::size_t base) -> bool
+    {
+        while (m_frames.size() > base)
+        {
+            auto&      frame  = m_frames.back();
+            const auto status = expand_frame(frame);
+
+            if (status == ExpansionStatus::Suspended)
+            {
+                continue;
+            }
+
+            if (status == ExpansionStatus::Failed)
+            {
+                auto rescanned = m_frames.size() - 1;
+                while (rescanned > base && !m_frames[rescanned - 1].rescan.has_value())
+                {
+                    rescanned--;
+                }
+
+                if (rescanned == base)
+                {
+                    unwind(base);
+                    return false;
+                }
+
+                unwind(rescanned);
+                abandon_rescan(m_frames.back());
+                continue;
+            }
+
+            finish(frame);
+            m_frames.pop_back();
+            if (m_frames.size() > base)
+            {
+                resume(m_frames.back());
+            }
+        }
+        return true;
+    }
+
+    /**
+     * Expand the frame until it finishes, fails, or reaches a nested call. Every arm which
+     * matches the arguments is applied in turn, until the arguments are exhausted.
+     */
+    auto expand_frame(ExpansionFrame& frame) -> ExpansionStatus
+    {
+        do
+        {
+            if (!frame.arm.has_value())
+            {
+                // Find the arm and bind its arguments.
+                frame.arm_begin = frame.target->size();
+                frame.arm = frame.rule->match(frame.args, &frame.arena, frame.known_repetitions, frame.repetitions);
+                if (!frame.arm.has_value())
+                {
+                    return ExpansionStatus::Failed;
+                }
+                frame.step = 0;
+
+                if (m_stats != nullptr) [[unlikely]]
+                {
+                    m_stats->arm_hit(frame.macro, frame.arm->index);
+                }
+            }
+
+            const auto status = frame.rule->apply(this, frame);
+            if (status != ExpansionStatus::Finished)
+            {
+                return status;
+            }
+            frame.arm.reset();
+
+            while (frame.args.peek().any_of(MactenAllToken::Newline))
+            {
+                frame.target->push_back(frame.args.pop());
+            }
+            frame.args.skip(MactenAllToken::Space, MactenAllToken::Newline, MactenAllToken::Tab);
+        } while (!frame.args.is_at_end());
+
+        return ExpansionStatus::Finished;
+    }
+
+    /**
+     * Resume the frame after its nested call has been expanded. The last tokens of an expansion
+     * written into the target are rescanned with the tokens after it.
+     */
+    auto resume(ExpansionFrame& frame) -> void
+    {
+        // A call found by the rescan of the pending tokens was expanded into the target, after
+        // the tokens before it. The rescan goes on from the step which flushed them.
+        if (frame.rescan.has_value())
+        {
+            return;
+        }
+
+        release_stream(frame.nested_args);
+
+        if (!frame.streamed)
+        {
+            frame.expanded.push_back({frame.call_begin, frame.pending->size()});
+            return;
+        }
+
+        auto&      target = *frame.target;
+        const auto from   = std::max(frame.call_begin, target.size() - std::min<std::size_t>(target.size(), 2));
+        if (from < target.size())
+        {
+            pending(frame).append(target, from, target.size());
+            while (target.size() > from)
+            {
+                target.pop_back();
+            }
+        }
+    }
+
+    /**
+     * Memoize the expansion of a frame which has finished, and return its streams.
+     */
+    auto finish(ExpansionFrame& frame) -> void
+    {
+        if (m_stats != nullptr) [[unlikely]]
+        {
+            // The frame is still on the stack, the frame below it made the call.
+            const auto time = RunStats::Clock::now() - frame.started;
+            m_stats->leave(frame.macro, time, time - frame.nested_time, frame.target->size() - frame.target_begin);
+            if (m_frames.size() > 1)
+            {
+                m_frames[m_frames.size() - 2].nested_time += time;
+            }
+        }
+
+        if (m_procedural_calls != frame.procedural_calls)
+        {
+            if (frame.macro >= m_uncached_macros.size())
+                m_uncached_macros.resize(frame.macro + 1);
+            m_uncached_macros[frame.macro] = true;
+        }
+        else if (!frame.key.empty())
+        {
+            m_expansion_cache.insert(frame.key, *frame.target, frame.target_begin, frame.target->size());
+        }
+
+        release_stream(frame.pending);
+        release_stream(frame.nested_args);
+        release_stream(frame.resolved_args);
+    }
+
+    /**
+     * Pop the frames above `base` after one of them failed. Every frame which failed to apply an
+     * arm reports it, from the innermost one out.
+     *
+     * The expansion of the arm the bottom frame was applying is removed from its target, as are
+     * the pending tokens of the frames above. Arms the bottom frame had finished are kept.
+     */
+    auto unwind(std::size_t base) -> void
+    {
+        while (m_frames.size() > base)
+        {
+            auto& frame = m_frames.back();
+            if (m_stats != nullptr) [[unlikely]]
+            {
+                m_stats->abandon(frame.macro);
+            }
+
+            if (m_expanding_ahead)
+            {
+                // Left to fail when the caller is invoked, if it ever is.
+                m_ahead_failed = true;
+            }
+            else if (frame.arm.has_value())
+            {
+                std::cerr << "Failed to apply macro: '" << m_symbols.name(frame.macro) << "'\n";
+            }
+
+            if (m_frames.size() == base + 1)
+            {
+                while (frame.target->size() > frame.arm_begin)
+                {
+                    frame.target->pop_back();
+                }
+            }
+            m_frames.pop_back();
+        }
+    }
+
+    /**
+     * Returns true if rescanning the stream on its own gives the same tokens as rescanning it
+     * followed by more tokens. It must not end inside a bracket, and must not end with a token
+     * which may start a macro call or a join with the tokens after it.
+     */
+    [[nodiscard]] static auto can_rescan_alone(const macten::TokenStream<MactenAllToken>& stream) -> bool
+    {
+        if (stream.empty())
+        {
+            return true;
+        }
+
+        const auto last = stream.type_at(stream.size() - 1);
+        return !stream.has_unclosed(TType::LSquare) && last != TType::Identifier &&
+               last != TType::Underscore && last != TType::Exclamation;
+    }
+
+    /**
+     * Lend an empty stream, reusing one returned earlier if there is one.
+     */
+    auto acquire_stream() -> std::unique_ptr<macten::TokenStream<MactenAllToken>>
+    {
+        if (m_free_streams.empty())
+        {
+            return std::make_unique<macten::TokenStream<MactenAllToken>>();
+        }
+
+        auto stream = std::move(m_free_streams.back());
+        m_free_streams.pop_back();
+        return stream;
+    }
+
+    /**
+     * Return a lent stream, if any. Its tokens are dropped and its buffers unpinned, its arrays
+     * are kept for the next time a stream is lent.
+     */
+    auto release_stream(std::unique_ptr<macten::TokenStream<MactenAllToken>>& stream) -> void
+    {
+        if (stream == nullptr)
+        {
+            return;
+        }
+
+        if (m_free_streams.size() < free_streams_size)
+        {
+            stream->reset();
+            m_free_streams.push_back(std::move(stream));
+        }
+        stream.reset();
+    }
+
+    /**
+     * Progress of the depth-first search of the call graph of the declarative macros. A macro is
+     * Recursive if it reaches a cycle, itself or another one.
+     */
+    enum class CallGraphState : std::uint8_t
+    {
+        Unvisited,
+        Visiting,
+        Acyclic,
+        Recursive,
+    };
+
+    /**
+     * Visit the declarative macro with the symbol `macro` and the macros its bodies call, if it
+     * has not been visited. Each macro is appended to `order` after the macros it calls.
+     */
+    auto visit_call_graph(Symbol macro, std::vector<CallGraphState>& states, std::vector<Symbol>& order) -> void
+    {
+        if (!has_declarative_macro(macro) || states[macro] != CallGraphState::Unvisited)
+        {
+            return;
+        }
+
+        states[macro] = CallGraphState::Visiting;
+
+        bool recursive{false};
+        for (const auto& plan : m_declarative_macro_rules[macro]->m_plans)
+        {
+            for (const auto& step : plan.steps())
+            {
+                if (step.kind != SubstitutionPlan::StepKind::Call || !has_declarative_macro(step.macro))
+                {
+                    continue;
+                }
+
+                visit_call_graph(step.macro, states, order);
+                recursive = recursive || states[step.macro] != CallGraphState::Acyclic;
+            }
+        }
+
+        states[macro] = recursive ? CallGraphState::Recursive : CallGraphState::Acyclic;
+        order.push_back(macro);
+    }
+
+    /**
+     * Expand the call step at `call` of the plan of an arm, whose body is `body`, ahead of its
+     * invocation. The arguments of the call must be literal. Returns none if the expansion
+     * failed, called a procedural macro, or is too long to be inlined.
+     *
+     * Calls formed by the rescan of an expansion are not in the call graph, so the number of
+     * calls is capped in case they recurse.
+     */
+    auto expand_ahead(const macten::TokenStream<MactenAllToken>& body, const SubstitutionPlan& plan,
+                      std::size_t call) -> std::optional<macten::TokenStream<MactenAllToken>>
+    {
+        const auto& steps = plan.steps();
+        const auto& step  = steps[call];
+
+        macten::TokenStream<MactenAllToken> arguments{};
+        for (auto argument = call + 1; argument < step.arguments_end; argument++)
+        {
+            arguments.append(body, steps[argument].begin, steps[argument].end);
+        }
+
+        macten::TokenStream<MactenAllToken> expansion{};
+
+        // Not a call of the run, it is left out of its statistics.
+        auto* const stats = std::exchange(m_stats, nullptr);
+
+        m_expanding_ahead = true;
+        m_ahead_failed    = false;
+        m_ahead_calls     = 0;
+        const bool success = match_and_execute_macro(expansion, step.macro, arguments.get_view());
+        m_expanding_ahead = false;
+        m_stats           = stats;
+
+        if (!success || m_ahead_failed || expansion.size() > inline_max_tokens)
+        {
+            return {};
+        }
+        return expansion;
+    }
+
+    /**
+     * Follows the preprocessed token stream to find where it can be split. A split is allowed
+     * after a line break which is outside of any macro call.
+     */
+    class SegmentTracker
+    {
+      public:
+        /**
+         * Feed the next token. Returns true if the stream can be split after it.
+         */
+        auto update(const cpp20scanner::Token<MactenAllToken>& token) -> bool
+        {
+            using TokenType = MactenAllToken;
+
+            if (m_call_depth > 0)
+            {
+                if (token.is(TokenType::LSquare))
+                    ++m_call_depth;
+                else if (token.is(TokenType::RSquare))
+                    --m_call_depth;
+            }
+            else if (token.is(TokenType::LSquare) && m_previous[0] == TokenType::Exclamation &&
+                     m_previous[1] == TokenType::Identifier)
+            {
+                m_call_depth = 1;
+            }
+
+            m_previous[1] = m_previous[0];
+            m_previous[0] = token.type;
+
+            return m_call_depth == 0 && token.is(TokenType::Newline);
+        }
+
+      private:
+        std::size_t                   m_call_depth{0};
+        std::array<MactenAllToken, 2> m_previous{MactenAllToken::Error, MactenAllToken::Error};
+    };
+
+    // Bytes read from the source per scanner refill, and the number of preprocessed tokens
+    // after which process() starts looking for a place to split the stream.
+    static constexpr std::size_t stream_chunk_size{std::size_t{1} << 16};
+    static constexpr std::size_t stream_segment_size{std::size_t{1} << 14};
+
+    // Bytes of keys and expansions the expansion cache holds, the size of the key of a call
+    // which is built without allocating, and the number of argument tokens above which a call
+    // is not memoized.
+    static constexpr std::size_t expansion_cache_budget{std::size_t{1} << 24};
+    static constexpr std::size_t expansion_key_size{256};
+    static constexpr std::size_t expansion_key_max_tokens{1024};
+
+    // Number of streams returned by expansion frames which are kept for reuse.
+    static constexpr std::size_t free_streams_size{64};
+
+    // Number of tokens of the longest expansion which is inlined in a macro body, and the number
+    // of calls an expansion ahead of time may make.
+    static constexpr std::size_t inline_max_tokens{256};
+    static constexpr std::size_t inline_max_calls{256};
+
     const std::string     m_source_path;
     const std::string     m_output_name;
+    SymbolTable           m_symbols;
     DeclarativeMacroRules m_declarative_macro_rules;
     ProceduralMacroRules  m_procedural_macro_rules;
+
+    // Memoized expansions. Macros which have called procedural macros are flagged by symbol and
+    // bypass it, m_procedural_calls counts the procedural calls made so far to find them.
+    ExpansionCache    m_expansion_cache{expansion_cache_budget};
+    std::vector<bool> m_uncached_macros;
+    std::size_t       m_procedural_calls{0};
+
+    // The expansion stack, and the streams lent to its frames which have been returned. Frames
+    // are never moved, the frames below the top are referred to while it expands.
+    std::deque<ExpansionFrame>                                        m_frames;
+    std::vector<std::unique_ptr<macten::TokenStream<MactenAllToken>>> m_free_streams;
+
+    // Set while a call is expanded ahead of time, see expand_ahead(). The expansion fails rather
+    // than report errors or call procedural macros, m_ahead_calls counts the calls it made.
+    bool        m_expanding_ahead{false};
+    bool        m_ahead_failed{false};
+    std::size_t m_ahead_calls{0};
+
+    // Where the statistics of the run are collected, if they are.
+    RunStats* m_stats{nullptr};
 };
 
 } // namespace macten
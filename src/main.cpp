@@ -6,7 +6,7 @@
 
 auto print_help() -> void
 {
- std::cout << "Usage: help | generate <path> | run <path> | clean" << '\n';
+ std::cout << "Usage: help | generate <path> | run <path> [output] [--stats[=json]] | clean" << '\n';
 }
 
 auto handle_generate(const std::vector<std::string>& command) -> void
@@ -32,8 +32,24 @@ auto handle_clean() -> void
  std::cout << "Removed macten files" << '\n';
 }
 
-auto handle_run(const std::vector<std::string>& command) -> void
+auto handle_run(std::vector<std::string> command) -> void
 {
+ // Statistics of the run, as tables or as JSON.
+ enum class StatsFormat { None, Text, Json };
+ StatsFormat stats_format { StatsFormat::None };
+
+ for (auto it = command.begin(); it != command.end();)
+ {
+  if (*it == "--stats") stats_format = StatsFormat::Text;
+  else if (*it == "--stats=json") stats_format = StatsFormat::Json;
+  else
+  {
+   ++it;
+   continue;
+  }
+  it = command.erase(it);
+ }
+
  if (command.size() < 2)
  {
   std::cerr << "Expected source path" << '\n';
@@ -60,12 +76,21 @@ auto handle_run(const std::vector<std::string>& command) -> void
  }
 
 
+ macten::RunStats stats{};
+
  macten::MactenWriter writer(file, dest);
+ if (stats_format != StatsFormat::None) writer.collect_stats(&stats);
+
+ // Statistics in JSON are all that is written to stdout, so they can be piped into a parser.
+ auto& status = stats_format == StatsFormat::Json ? std::cerr : std::cout;
+
  if (writer.process())
-  std::cout << "Successfully processed macros" << '\n';
+  status << "Successfully processed macros" << '\n';
  else
   std::cerr << "Failed to process macros" << '\n';
 
+ if (stats_format == StatsFormat::Text) stats.write_text(std::cout, writer.symbols());
+ else if (stats_format == StatsFormat::Json) stats.write_json(std::cout, writer.symbols());
 }
 
 auto main(int argc, char* argv[]) -> int 
@@ -0,0 +1,131 @@
+#include <cstdio>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+#include "token_stream.hpp"
+
+/**
+ * Checks that parallel scans produce the tokens of a serial scan, for whole token streams and
+ * for lazily scanned ones, on inputs whose chunk and batch boundaries land in awkward places.
+ */
+
+struct Scanned
+{
+ MactenAllToken type;
+ std::string lexeme;
+ cpp20scanner::SourceLocation location;
+};
+
+auto same(const std::vector<Scanned>& expected, const std::vector<Scanned>& actual) -> bool
+{
+ if (expected.size() != actual.size()) return false;
+ for (std::size_t i {0}; i < expected.size(); i++)
+ {
+  const auto& e = expected[i];
+  const auto& a = actual[i];
+  if (e.type != a.type || e.lexeme != a.lexeme || e.location.line != a.location.line || e.location.column != a.location.column) return false;
+ }
+ return true;
+}
+
+auto record(const cpp20scanner::Token<MactenAllToken>& token) -> Scanned
+{
+ return {token.type, std::string(token.lexeme), token.location()};
+}
+
+auto serial(const std::string& path) -> std::vector<Scanned>
+{
+ std::vector<Scanned> tokens{};
+ MactenAllTokenScanner scanner{};
+ scanner.read_source(path);
+ while (!scanner.is_at_end()) tokens.push_back(record(scanner.scan_token()));
+ return tokens;
+}
+
+auto whole(const macten::TokenStream<MactenAllToken>& stream) -> std::vector<Scanned>
+{
+ std::vector<Scanned> tokens{};
+ for (std::size_t i {0}; i < stream.size(); i++) tokens.push_back(record(stream.at(i)));
+ return tokens;
+}
+
+auto lazy(macten::LazyTokenStream<MactenAllToken> stream) -> std::vector<Scanned>
+{
+ std::vector<Scanned> tokens{};
+ while (!stream.is_at_end())
+ {
+  tokens.push_back(record(stream.pop()));
+  stream.release_consumed();
+ }
+ return tokens;
+}
+
+auto inputs() -> std::vector<std::pair<std::string, std::string>>
+{
+ std::string mixed{};
+ for (int line {0}; line < 2000; line++)
+ {
+  mixed += "value_" + std::to_string(line) + " = compute(" + std::to_string(line * 7) + ", 'text') / 2";
+  if (line % 3 == 0) mixed += " // a comment with / slashes, \"quotes\" and sym!bols";
+  if (line % 5 == 0) mixed += "   \t ";
+  if (line % 7 == 0) mixed += "\n\n";
+  mixed += '\n';
+ }
+
+ std::string long_line(200000, 'x');
+ long_line += " = 1\nshort\n" + std::string(70000, ' ') + "tail";
+
+ return {
+  {"mixed", mixed},
+  {"no final line break", mixed + "last = line"},
+  {"trailing whitespace", mixed + "   \n  "},
+  {"ends in a comment", mixed + "// the end"},
+  {"long lines", long_line},
+  {"only whitespace", "  \n\n \t \n"},
+  {"empty", ""},
+ };
+}
+
+auto main() -> int
+{
+ const auto path = (std::filesystem::temp_directory_path() / "macten_parallel_scan_test.txt").string();
+ int failures {0};
+
+ const auto check = [&](const std::string& name, const std::vector<Scanned>& expected, const std::vector<Scanned>& actual) {
+  if (same(expected, actual)) return;
+  std::cerr << "FAIL: " << name << " (" << expected.size() << " tokens expected, " << actual.size() << " scanned)" << '\n';
+  failures++;
+ };
+
+ for (const auto& [name, content] : inputs())
+ {
+  {
+   std::ofstream file(path, std::ios::binary);
+   file << content;
+  }
+
+  const auto expected = serial(path);
+
+  for (std::size_t threads {1}; threads <= 8; threads++)
+  {
+   const auto label = name + ", " + std::to_string(threads) + " threads";
+   check(label + ", TokenStream", expected, whole(macten::TokenStream<MactenAllToken>::from_file_parallel(path, threads)));
+
+   for (const std::size_t batch : {std::size_t{1}, std::size_t{100}, std::size_t{4096}, std::size_t{1} << 20})
+   {
+    check(label + ", LazyTokenStream batch " + std::to_string(batch), expected, lazy(macten::LazyTokenStream<MactenAllToken>::from_file_parallel(path, threads, batch)));
+   }
+  }
+
+  check(name + ", LazyTokenStream chunked", expected, lazy(macten::LazyTokenStream<MactenAllToken>::from_file(path, 4096)));
+ }
+
+ std::filesystem::remove(path);
+
+ if (failures != 0) return 1;
+ std::cout << "Parallel scans match the serial scan" << '\n';
+ return 0;
+}
@@ -210,7 +210,7 @@ class MactenParser final : public cpp20scanner::BaseParser<MactenTokenScanner, M
     {
         std::stringstream ss {};
         consume(Token::Identifier, message);
-        return previous.lexeme;
+        return std::string(previous.lexeme);
     }
 
     /**
@@ -352,7 +352,7 @@ class MactenParser final : public cpp20scanner::BaseParser<MactenTokenScanner, M
 
                     // Add the rule
                     const auto rule_value_token = previous;
-                    entry.push_back(rule_value_token.lexeme);
+                    entry.emplace_back(rule_value_token.lexeme);
 
                     if (rule_value_token.lexeme == rule_label)
                         rule.second = true;
@@ -0,0 +1,332 @@
+#ifndef MACTEN_RUN_STATS_HPP
+#define MACTEN_RUN_STATS_HPP
+
+#include <algorithm>
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <ostream>
+#include <string_view>
+#include <vector>
+
+#include "symbol_table.hpp"
+
+namespace macten
+{
+
+/**
+ * Statistics of a run of the writer, collected when `macten run` is given `--stats`.
+ *
+ * The writer only collects them when it has been handed a RunStats, every counter is behind a
+ * check of that pointer, so a run without statistics pays for a branch which is never taken.
+ *
+ * Phase times exclude the phases nested in them: scanning happens as the source is
+ * preprocessed, and procedural calls as it is expanded, so the times of the phases add up to
+ * the time of the run. Macro times are wall times from the start of an expansion to its end.
+ * The cumulative time and the tokens emitted by a recursive macro only count its outermost
+ * expansions, its self time excludes the nested macro calls.
+ */
+class RunStats
+{
+  public:
+    using Clock    = std::chrono::steady_clock;
+    using Duration = Clock::duration;
+
+    enum class Phase : std::uint8_t
+    {
+        // Tokens scanned from the source.
+        Scan,
+        // Tokens of the declarative macro bodies.
+        DefinitionParse,
+        // Tokens left once the definitions are removed and the call sites tidied.
+        Preprocess,
+        // Tokens of the expanded source.
+        Expansion,
+        // Tokens written by procedural macros.
+        ProceduralCalls,
+        // Tokens written to the output.
+        OutputWrite,
+    };
+
+    static constexpr std::size_t phase_count{6};
+
+    struct PhaseStats
+    {
+        Duration    time{};
+        std::size_t tokens{0};
+    };
+
+    struct MacroStats
+    {
+        bool procedural{false};
+
+        // Calls of the macro during the expansion, and those answered by the expansion cache.
+        std::size_t calls{0};
+        std::size_t cache_hits{0};
+
+        // Number of times each arm matched, by arm index.
+        std::vector<std::size_t> arm_hits;
+
+        std::size_t tokens_emitted{0};
+        Duration    cumulative_time{};
+        Duration    self_time{};
+
+        // Expansions of the macro in progress, and the most there ever were at once.
+        std::size_t depth{0};
+        std::size_t max_depth{0};
+    };
+
+    /**
+     * Returns the statistics of the phase.
+     */
+    [[nodiscard]] auto phase(Phase phase) noexcept -> PhaseStats&
+    {
+        return m_phases[static_cast<std::size_t>(phase)];
+    }
+
+    [[nodiscard]] auto phase(Phase phase) const noexcept -> const PhaseStats&
+    {
+        return m_phases[static_cast<std::size_t>(phase)];
+    }
+
+    /**
+     * Returns the statistics of the macro with the symbol `macro`.
+     */
+    [[nodiscard]] auto macro(Symbol macro) -> MacroStats&
+    {
+        if (macro >= m_macros.size())
+        {
+            m_macros.resize(macro + 1);
+        }
+        return m_macros[macro];
+    }
+
+    /**
+     * Record the start of an expansion of the declarative macro.
+     */
+    auto enter(Symbol macro) -> void
+    {
+        auto& stats     = this->macro(macro);
+        stats.max_depth = std::max(stats.max_depth, ++stats.depth);
+    }
+
+    /**
+     * Record the end of an expansion of the declarative macro, which took `time`, `self_time` of
+     * it outside of nested calls, and emitted `tokens` tokens. Like its time, the tokens of a
+     * recursive macro are only counted for its outermost expansions.
+     */
+    auto leave(Symbol macro, Duration time, Duration self_time, std::size_t tokens) -> void
+    {
+        auto& stats = this->macro(macro);
+        if (--stats.depth == 0)
+        {
+            stats.cumulative_time += time;
+            stats.tokens_emitted += tokens;
+        }
+        stats.self_time += self_time;
+    }
+
+    /**
+     * Record the end of an expansion of the declarative macro which failed.
+     */
+    auto abandon(Symbol macro) -> void
+    {
+        this->macro(macro).depth--;
+    }
+
+    /**
+     * Record a call of the declarative macro answered by the expansion cache with `tokens` tokens.
+     */
+    auto cache_hit(Symbol macro, std::size_t tokens) -> void
+    {
+        auto& stats = this->macro(macro);
+        stats.cache_hits++;
+        if (stats.depth == 0)
+        {
+            stats.tokens_emitted += tokens;
+        }
+    }
+
+    /**
+     * Record a call of the declarative macro, which has `arms` arms. Its arms are listed even if
+     * none of them ever matches.
+     */
+    auto call(Symbol macro, std::size_t arms) -> void
+    {
+        auto& stats = this->macro(macro);
+        stats.calls++;
+        stats.arm_hits.resize(std::max(stats.arm_hits.size(), arms));
+    }
+
+    /**
+     * Record the match of an arm of a declarative macro, after its call was recorded.
+     */
+    auto arm_hit(Symbol macro, std::size_t arm) -> void
+    {
+        this->macro(macro).arm_hits[arm]++;
+    }
+
+    /**
+     * Record a call of the procedural macro, which took `time` and emitted `tokens` tokens.
+     */
+    auto procedural_call(Symbol macro, Duration time, std::size_t tokens) -> void
+    {
+        auto& stats      = this->macro(macro);
+        stats.procedural = true;
+        stats.calls++;
+        stats.tokens_emitted += tokens;
+        stats.cumulative_time += time;
+        stats.self_time += time;
+        stats.max_depth = std::max<std::size_t>(stats.max_depth, 1);
+
+        auto& phase = this->phase(Phase::ProceduralCalls);
+        phase.time += time;
+        phase.tokens += tokens;
+    }
+
+    /**
+     * Write the statistics as tables.
+     */
+    auto write_text(std::ostream& os, const SymbolTable& symbols) const -> void
+    {
+        const auto flags     = os.flags();
+        const auto precision = os.precision();
+        os << std::fixed << std::setprecision(3);
+
+        os << std::left << std::setw(18) << "phase" << std::right << std::setw(12) << "time (ms)"
+           << std::setw(12) << "tokens" << '\n';
+        Duration total{};
+        for (std::size_t index{0}; index < phase_count; index++)
+        {
+            const auto& stats = m_phases[index];
+            os << std::left << std::setw(18) << phase_names[index] << std::right << std::setw(12)
+               << milliseconds(stats.time) << std::setw(12) << stats.tokens << '\n';
+            total += stats.time;
+        }
+        os << std::left << std::setw(18) << "total" << std::right << std::setw(12) << milliseconds(total)
+           << '\n';
+
+        os << '\n'
+           << std::left << std::setw(20) << "macro" << std::setw(6) << "kind" << std::right << std::setw(10)
+           << "calls" << std::setw(10) << "cached" << std::setw(10) << "tokens" << std::setw(14) << "cumul. (ms)"
+           << std::setw(12) << "self (ms)" << std::setw(8) << "depth" << "  arm hits\n";
+        for (const auto macro : sorted_macros())
+        {
+            const auto& stats = m_macros[macro];
+            os << std::left << std::setw(20) << symbols.name(macro) << std::setw(6)
+               << (stats.procedural ? "proc" : "dec") << std::right << std::setw(10) << stats.calls
+               << std::setw(10) << stats.cache_hits << std::setw(10) << stats.tokens_emitted << std::setw(14)
+               << milliseconds(stats.cumulative_time) << std::setw(12) << milliseconds(stats.self_time)
+               << std::setw(8) << stats.max_depth << ' ';
+            for (const auto hits : stats.arm_hits)
+            {
+                os << ' ' << hits;
+            }
+            os << '\n';
+        }
+
+        os.flags(flags);
+        os.precision(precision);
+    }
+
+    /**
+     * Write the statistics as a JSON object. Times are in nanoseconds.
+     */
+    auto write_json(std::ostream& os, const SymbolTable& symbols) const -> void
+    {
+        os << "{\n  \"phases\": {";
+        for (std::size_t index{0}; index < phase_count; index++)
+        {
+            const auto& stats = m_phases[index];
+            os << (index == 0 ? "\n" : ",\n") << "    \"" << json_names[index]
+               << "\": {\"time_ns\": " << nanoseconds(stats.time) << ", \"tokens\": " << stats.tokens << '}';
+        }
+        os << "\n  },\n  \"macros\": [";
+
+        bool first{true};
+        for (const auto macro : sorted_macros())
+        {
+            const auto& stats = m_macros[macro];
+            os << (first ? "\n" : ",\n") << "    {\"name\": ";
+            write_json_string(os, symbols.name(macro));
+            os << ", \"kind\": \"" << (stats.procedural ? "procedural" : "declarative")
+               << "\", \"calls\": " << stats.calls << ", \"cache_hits\": " << stats.cache_hits
+               << ", \"arm_hits\": [";
+            for (std::size_t arm{0}; arm < stats.arm_hits.size(); arm++)
+            {
+                os << (arm == 0 ? "" : ", ") << stats.arm_hits[arm];
+            }
+            os << "], \"tokens_emitted\": " << stats.tokens_emitted
+               << ", \"cumulative_time_ns\": " << nanoseconds(stats.cumulative_time)
+               << ", \"self_time_ns\": " << nanoseconds(stats.self_time)
+               << ", \"max_depth\": " << stats.max_depth << '}';
+            first = false;
+        }
+        os << "\n  ]\n}\n";
+    }
+
+  private:
+    /**
+     * Returns the symbols of the macros which were called, by decreasing cumulative time.
+     */
+    [[nodiscard]] auto sorted_macros() const -> std::vector<Symbol>
+    {
+        std::vector<Symbol> macros{};
+        for (Symbol macro{0}; macro < m_macros.size(); macro++)
+        {
+            if (m_macros[macro].calls > 0)
+            {
+                macros.push_back(macro);
+            }
+        }
+
+        std::stable_sort(macros.begin(), macros.end(), [this](Symbol lhs, Symbol rhs) {
+            return m_macros[lhs].cumulative_time > m_macros[rhs].cumulative_time;
+        });
+        return macros;
+    }
+
+    [[nodiscard]] static auto milliseconds(Duration time) -> double
+    {
+        return std::chrono::duration<double, std::milli>(time).count();
+    }
+
+    [[nodiscard]] static auto nanoseconds(Duration time) -> long long
+    {
+        return static_cast<long long>(std::chrono::duration_cast<std::chrono::nanoseconds>(time).count());
+    }
+
+    static auto write_json_string(std::ostream& os, std::string_view text) -> void
+    {
+        os << '"';
+        for (const auto c : text)
+        {
+            if (c == '"' || c == '\\')
+            {
+                os << '\\';
+            }
+            os << c;
+        }
+        os << '"';
+    }
+
+    static constexpr std::array<std::string_view, phase_count> phase_names{
+        "scan", "definition parse", "preprocess", "expansion", "procedural calls", "output write",
+    };
+    static constexpr std::array<std::string_view, phase_count> json_names{
+        "scan", "definition_parse", "preprocess", "expansion", "procedural_calls", "output_write",
+    };
+
+    /**
+     * Members.
+     */
+    std::array<PhaseStats, phase_count> m_phases{};
+
+    // Indexed by the symbol of the macro name.
+    std::vector<MacroStats> m_macros;
+};
+
+} // namespace macten
+
+#endif /* MACTEN_RUN_STATS_HPP */
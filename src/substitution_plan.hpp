@@ -0,0 +1,228 @@
+#ifndef MACTEN_SUBSTITUTION_PLAN_HPP
+#define MACTEN_SUBSTITUTION_PLAN_HPP
+
+#include <algorithm>
+#include <cstddef>
+#include <cstdint>
+#include <vector>
+
+#include "declarative_parameter.hpp"
+#include "macten_all_tokens.hpp"
+#include "symbol_table.hpp"
+#include "token_stream.hpp"
+#include "utils.hpp"
+
+namespace macten
+{
+
+/**
+ * The body of a declarative macro arm, compiled into the steps which expand it.
+ *
+ * The body is scanned once, when the macro is defined, instead of on every expansion. Runs of
+ * tokens which are copied as they are become one literal step, `$name` references become
+ * parameter steps which refer to the binding of the argument by its position, and nested macro
+ * calls become call steps with the substitution of their arguments planned in advance.
+ *
+ * Whether a call site names a declarative macro is only known when it is expanded, since the
+ * macro may be defined after this one. The steps of a call are therefore followed by the steps
+ * of its arguments, then by the plain substitution of the whole call site, which is the
+ * fallback if the name is not a declarative macro:
+ *
+ *     Call, arguments... , fallback... , next step
+ *          ^              ^             ^
+ *          call + 1       arguments_end next
+ *
+ * Steps hold indices into the body stream only, so the body is passed to the plan when it is
+ * compiled, and must be the same stream its steps are applied to.
+ *
+ * Once all macros are defined, a call whose expansion is the same on every invocation may be
+ * replaced with that expansion, see MactenWriter::inline_declarative_calls(). The call step then
+ * becomes an inlined step, and its argument and fallback steps are skipped.
+ */
+class SubstitutionPlan
+{
+  private:
+    using TokenType = MactenAllToken;
+    using View      = ATS::View;
+
+  public:
+    enum class StepKind : std::uint8_t
+    {
+        // Copy the body tokens [begin, end).
+        Literal,
+        // Substitute the argument bound at `slot`. The `$name` tokens are [begin, end).
+        Parameter,
+        // Expand the nested call whose tokens are [begin, end) if `macro` is a declarative macro.
+        Call,
+        // Insert the expansion of the call [begin, end), held by the plan at `slot`.
+        Inlined,
+    };
+
+    struct Step
+    {
+        StepKind      kind{StepKind::Literal};
+        std::size_t   begin{0};
+        std::size_t   end{0};
+        std::size_t   slot{0};
+        Symbol        macro{no_symbol};
+        std::uint32_t arguments_end{0};
+        std::uint32_t next{0};
+    };
+
+    /**
+     * Default Constructor. Returns an empty plan.
+     */
+    SubstitutionPlan() = default;
+
+    /**
+     * Compile the body of an arm. The parameter names and the body must have been interned.
+     */
+    SubstitutionPlan(const ATS& body, const DeclarativeMacroParameter& param)
+    {
+        compile(body, 0, body.size(), param);
+    }
+
+    /**
+     * Returns the steps of the plan.
+     */
+    [[nodiscard]] auto steps() const noexcept -> const std::vector<Step>&
+    {
+        return m_steps;
+    }
+
+    /**
+     * Returns true if the arguments of the call step at `call` have no parameter steps, so they
+     * are the same on every expansion.
+     */
+    [[nodiscard]] auto has_literal_arguments(std::size_t call) const -> bool
+    {
+        const auto first = m_steps.begin() + static_cast<std::ptrdiff_t>(call + 1);
+        const auto last  = m_steps.begin() + m_steps[call].arguments_end;
+        return std::all_of(first, last, [](const Step& step) { return step.kind == StepKind::Literal; });
+    }
+
+    /**
+     * Replace the call step at `call` with the expansion of the call.
+     */
+    auto inline_call(std::size_t call, ATS expansion) -> void
+    {
+        m_steps[call].kind = StepKind::Inlined;
+        m_steps[call].slot = m_expansions.size();
+        m_expansions.push_back(std::move(expansion));
+    }
+
+    /**
+     * Returns the expansion an inlined step refers to by its slot.
+     */
+    [[nodiscard]] auto expansion(std::size_t slot) const noexcept -> const ATS&
+    {
+        return m_expansions[slot];
+    }
+
+  private:
+    /**
+     * Compile the body tokens [begin, end).
+     */
+    auto compile(const ATS& body, std::size_t begin, std::size_t end, const DeclarativeMacroParameter& param)
+        -> void
+    {
+        View view(begin, end, &body);
+
+        while (!view.is_at_end())
+        {
+            const auto position = view.position();
+
+            if (view.match_sequence(TokenType::Dollar, TokenType::Identifier))
+            {
+                if (const auto slot = param.slot(view.peek_symbol(1)); slot.has_value())
+                {
+                    m_steps.push_back(
+                        {.kind = StepKind::Parameter, .begin = position, .end = position + 2, .slot = *slot});
+                    view.advance(2);
+                    continue;
+                }
+            }
+            else if (utils::is_macro_call(view))
+            {
+                const auto arguments = view.between(TokenType::LSquare, TokenType::RSquare, false);
+                const auto call_end  = std::min(arguments.size() + 1, end);
+                compile_call(body, position, arguments, call_end, param);
+                view.advance(call_end - position);
+                continue;
+            }
+
+            literal(position, position + 1);
+            view.advance();
+        }
+    }
+
+    /**
+     * Compile the call site [begin, end), whose arguments are the tokens of the view.
+     */
+    auto compile_call(const ATS& body, std::size_t begin, View arguments, std::size_t end,
+                      const DeclarativeMacroParameter& param) -> void
+    {
+        const auto call = m_steps.size();
+        m_steps.push_back(
+            {.kind = StepKind::Call, .begin = begin, .end = end, .macro = body.symbol_at(begin)});
+
+        // Arguments are substituted, nested calls in them are left to the callee.
+        while (!arguments.is_at_end())
+        {
+            const auto position = arguments.position();
+
+            if (arguments.match_sequence(TokenType::Dollar, TokenType::Identifier))
+            {
+                if (const auto slot = param.slot(arguments.peek_symbol(1)); slot.has_value())
+                {
+                    m_steps.push_back(
+                        {.kind = StepKind::Parameter, .begin = position, .end = position + 2, .slot = *slot});
+                    arguments.advance(2);
+                    continue;
+                }
+            }
+
+            literal(position, position + 1);
+            arguments.advance();
+        }
+        m_steps[call].arguments_end = static_cast<std::uint32_t>(m_steps.size());
+        m_literal_start             = m_steps.size();
+
+        // The fallback takes the name as it is, and substitutes the rest of the call site.
+        literal(begin, begin + 1);
+        compile(body, begin + 1, end, param);
+        m_steps[call].next = static_cast<std::uint32_t>(m_steps.size());
+        m_literal_start    = m_steps.size();
+    }
+
+    /**
+     * Add a step which copies the body tokens [begin, end), extending the last step if it is a
+     * literal run which ends at `begin`.
+     */
+    auto literal(std::size_t begin, std::size_t end) -> void
+    {
+        if (m_steps.size() > m_literal_start && m_steps.back().kind == StepKind::Literal &&
+            m_steps.back().end == begin)
+        {
+            m_steps.back().end = end;
+            return;
+        }
+        m_steps.push_back({.kind = StepKind::Literal, .begin = begin, .end = end});
+    }
+
+    /**
+     * Members.
+     */
+    std::vector<Step> m_steps;
+
+    // The expansions of the inlined calls.
+    std::vector<ATS> m_expansions;
+
+    // Literal runs before this step are closed, a call's argument or fallback steps must not
+    // run into the steps after them.
+    std::size_t m_literal_start{0};
+};
+
+} // namespace macten
+
+#endif /* MACTEN_SUBSTITUTION_PLAN_HPP */
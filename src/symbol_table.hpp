@@ -0,0 +1,84 @@
+#ifndef MACTEN_SYMBOL_TABLE_HPP
+#define MACTEN_SYMBOL_TABLE_HPP
+
+#include <cstdint>
+#include <deque>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+
+namespace macten
+{
+
+/**
+ * Dense 32-bit identifier of an interned name.
+ */
+using Symbol = std::uint32_t;
+
+/**
+ * Symbol of names which have not been interned.
+ */
+inline constexpr Symbol no_symbol{UINT32_MAX};
+
+/**
+ * Interns names into dense symbols, numbered from zero in the order they are first seen. Once
+ * interned, names can be compared, and used as keys, by integer.
+ *
+ * The names which matter during expansion (macro names, parameter names and pattern literals)
+ * are interned when the definitions are registered. The tokens being expanded are only looked
+ * up with find(), any name which is not in the table resolves to `no_symbol`, so the table does
+ * not grow with the size of the source.
+ */
+class SymbolTable
+{
+  public:
+    /**
+     * Returns the symbol of the name, interning it if it is new.
+     */
+    auto intern(std::string_view name) -> Symbol
+    {
+        if (const auto found = m_symbols.find(name); found != m_symbols.end())
+        {
+            return found->second;
+        }
+
+        const auto  symbol = static_cast<Symbol>(m_names.size());
+        const auto& stored = m_names.emplace_back(name);
+        m_symbols.emplace(stored, symbol);
+        return symbol;
+    }
+
+    /**
+     * Returns the symbol of the name, or `no_symbol` if it has not been interned.
+     */
+    [[nodiscard]] auto find(std::string_view name) const noexcept -> Symbol
+    {
+        const auto found = m_symbols.find(name);
+        return found == m_symbols.end() ? no_symbol : found->second;
+    }
+
+    /**
+     * Returns the name of an interned symbol.
+     */
+    [[nodiscard]] auto name(Symbol symbol) const -> std::string_view
+    {
+        return m_names.at(symbol);
+    }
+
+    /**
+     * Returns the number of interned symbols. Symbols are below this number.
+     */
+    [[nodiscard]] auto size() const noexcept -> std::size_t
+    {
+        return m_names.size();
+    }
+
+  private:
+    // The deque keeps the names in place as it grows, so the keys of the map stay valid.
+    std::deque<std::string>                       m_names;
+    std::unordered_map<std::string_view, Symbol> m_symbols;
+};
+
+} // namespace macten
+
+#endif /* MACTEN_SYMBOL_TABLE_HPP */
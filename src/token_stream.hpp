@@ -4,17 +4,157 @@
 
 #include <sstream>
 #include <string>
+#include <utility>
 #include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <deque>
+#include <filesystem>
+#include <iterator>
+#include <memory>
+#include <memory_resource>
+#include <optional>
+#include <ostream>
+#include <thread>
+#include <type_traits>
+#include <vector>
 
 // This is required for the Token class.
 #include "macten_all_tokens.hpp"
 #include "macten_tokens.hpp"
+#include "symbol_table.hpp"
 
 namespace macten
 {
 
+/**
+ * Scans ranges of a source buffer on several threads, with the same result as a serial scan.
+ *
+ * A range is split into chunks which end just after a line break. No token spans a line break
+ * and a `//` comment ends at one, so every chunk begins in the scanner's initial state. Chunks
+ * are scanned in place (see Scanner::set_range), their locations are already those of the whole
+ * buffer and the per chunk results only need to be concatenated. The one fix up is EndOfFile: a
+ * serial scan emits it only when ignored bytes trail the last token, so it is dropped from every
+ * chunk and re-added by the caller once the buffer is exhausted, see end_token().
+ */
+template <typename TokenType>
+class ParallelScan
+{
+ public:
+ /**
+  * Aliases.
+  */
+ using Token = cpp20scanner::Token<TokenType>;
+ using Scanner = typename TokenType::Scanner;
+ using SourceBuffer = cpp20scanner::SourceBuffer;
+
+ ParallelScan(std::shared_ptr<const SourceBuffer> buffer, std::size_t thread_count)
+  : m_buffer(std::move(buffer))
+  , m_thread_count(std::max<std::size_t>(thread_count, 1))
+ {
+ }
+
+ /**
+  * Returns the position just after the first line break at or after `pos`, or the end of the
+  * buffer. Ranges passed to scan() must start and end on such positions.
+  */
+ [[nodiscard]] auto line_start_after(std::size_t pos) const noexcept -> std::size_t
+ {
+  const auto source = m_buffer->view();
+  const auto eol    = source.find('\n', std::min(pos, source.size()));
+  return eol == std::string_view::npos ? source.size() : eol + 1;
+ }
+
+ /**
+  * Scan the bytes in [begin, end), calling `emit` with every token in source order.
+  */
+ template <typename Emit>
+ auto scan(std::size_t begin, std::size_t end, Emit&& emit) -> void
+ {
+  // A few chunks per thread evens out lines of uneven density.
+  const auto               chunk_target = m_thread_count * 4;
+  std::vector<std::size_t> bounds {begin};
+  for (std::size_t chunk {1}; chunk < chunk_target; ++chunk)
+  {
+   const auto bound = line_start_after(std::max(bounds.back(), begin + (end - begin) * chunk / chunk_target));
+   if (bound >= end) break;
+   bounds.push_back(bound);
+  }
+  bounds.push_back(end);
+
+  // The token vectors are kept between calls, so scanning a range in batches reuses them.
+  const auto               chunk_count = bounds.size() - 1;
+  auto&                    chunk_tokens = m_chunk_tokens;
+  std::atomic<std::size_t> next_chunk {0};
+  if (chunk_tokens.size() < chunk_count) chunk_tokens.resize(chunk_count);
+
+  const auto worker = [&] {
+   Scanner scanner{};
+   for (auto chunk = next_chunk++; chunk < chunk_count; chunk = next_chunk++)
+   {
+    scanner.set_range(m_buffer, bounds[chunk], bounds[chunk + 1]);
+    auto& tokens = chunk_tokens[chunk];
+    tokens.clear();
+    while (!scanner.is_at_end())
+    {
+     const auto token = scanner.scan_token();
+     if (!token.is(TokenType::EndOfFile)) tokens.push_back(token);
+    }
+   }
+  };
+
+  {
+   std::vector<std::jthread> pool {};
+   for (std::size_t thread {1}; thread < std::min(m_thread_count, chunk_count); ++thread)
+   {
+    pool.emplace_back(worker);
+   }
+   worker();
+  }
+
+  for (std::size_t chunk {0}; chunk < chunk_count; ++chunk)
+  {
+   for (const auto& token : chunk_tokens[chunk])
+   {
+    m_last_end = token.offset() + token.lexeme.size();
+    emit(token);
+   }
+  }
+ }
+
+ /**
+  * Returns the EndOfFile token a serial scan of the whole buffer ends with, if it emits one.
+  * Call it once every range of the buffer has been scanned.
+  */
+ [[nodiscard]] auto end_token() const -> std::optional<Token>
+ {
+  const auto source = m_buffer->view();
+  if (m_last_end >= source.size()) return std::nullopt;
+  return Token(TokenType::EndOfFile, source.substr(source.size()), m_buffer.get());
+ }
+
+ private:
+ /**
+  * Members.
+  */
+ std::shared_ptr<const SourceBuffer> m_buffer;
+ std::size_t                         m_thread_count;
+
+ // End of the last token emitted so far.
+ std::size_t m_last_end {0};
+
+ // Tokens of each chunk of the range being scanned.
+ std::vector<std::vector<Token>> m_chunk_tokens {};
+};
+
  /**
   * A stream of tokens of the specified token type.
+  *
+  * Token lexemes are views into source buffers. The stream pins the buffer of every token
+  * pushed into it, so its tokens stay valid for as long as the stream is alive, regardless
+  * of where they were scanned from.
   */
 template <typename TokenType>
 struct TokenStream
@@ -24,6 +164,7 @@ struct TokenStream
   */
  using Token = cpp20scanner::Token<TokenType>;
  using Scanner = typename TokenType::Scanner;
+ using SourceBuffer = cpp20scanner::SourceBuffer;
 
  /**
   * Structures.
@@ -81,17 +222,57 @@ struct TokenStream
     return m_current_pointer - m_initial_start_pointer;
    }
 
+  /**
+   * Returns the index of the top token in the underlying stream.
+   */
+  [[nodiscard]] auto position() const noexcept -> std::size_t
+  {
+   return m_current_pointer;
+  }
+
+  /**
+   * Returns the stream being viewed.
+   */
+  [[nodiscard]] auto target() const noexcept -> const TokenStream*
+  {
+   return m_target;
+  }
+
   /**
    * Returns the top Token with an offset.
    *
    * NOTE: If the index is greater than the size of the view, EndOfFile will be returned.
    */
-  [[nodiscard]] auto peek(std::size_t offset = 0) const noexcept -> const Token&
+  [[nodiscard]] auto peek(std::size_t offset = 0) const noexcept -> Token
   {
     const bool invalid_target = m_target == nullptr;
-    if (invalid_target || is_at_end(offset)) return m_eof_token;
+    if (invalid_target || is_at_end(offset)) return Token();
 
-    return m_target->m_tokens[m_current_pointer + offset];
+    return m_target->get(m_current_pointer + offset);
+  }
+
+  /**
+   * Returns the type of the top Token with an offset, read straight from the type array.
+   *
+   * NOTE: If the index is greater than the size of the view, EndOfFile will be returned.
+   */
+  [[nodiscard]] auto peek_type(std::size_t offset = 0) const noexcept -> TokenType
+  {
+    const bool invalid_target = m_target == nullptr;
+    if (invalid_target || is_at_end(offset)) return TokenType::EndOfFile;
+
+    return m_target->m_types[m_current_pointer + offset];
+  }
+
+  /**
+   * Returns the symbol of the top Token with an offset, see TokenStream::symbol_at().
+   */
+  [[nodiscard]] auto peek_symbol(std::size_t offset = 0) const noexcept -> Symbol
+  {
+    const bool invalid_target = m_target == nullptr;
+    if (invalid_target || is_at_end(offset)) return no_symbol;
+
+    return m_target->symbol_at(m_current_pointer + offset);
   }
 
   /**
@@ -99,7 +280,7 @@ struct TokenStream
    */
   [[nodiscard]] auto front_is(TokenType expected) const noexcept -> bool
   {
-   return peek().is(expected);
+   return peek_type() == expected;
   }
 
   /**
@@ -121,7 +302,7 @@ struct TokenStream
   [[nodiscard]] auto match_sequence(TokenTypes... tokens) const noexcept -> bool
   {
     std::size_t offset {0};
-    return ((peek(offset++).type == tokens) && ...);
+    return ((peek_type(offset++) == tokens) && ...);
   }
 
   /**
@@ -178,8 +359,8 @@ struct TokenStream
   template<std::same_as<TokenType> ...Tokens>
   [[nodiscard]] auto match(Tokens... tokens) -> bool 
   {
-   const auto token = peek();
-   return token.any_of(tokens...);
+   const auto type = peek_type();
+   return ((type == tokens) || ...);
   }
 
   /**
@@ -188,8 +369,7 @@ struct TokenStream
   template<std::same_as<TokenType> ...Tokens>
   [[nodiscard]] auto consume(Tokens... tokens) -> bool 
   {
-   const auto token = peek();
-   const bool matched = token.any_of(tokens...);
+   const bool matched = match(tokens...);
 
    if (matched)
      advance();
@@ -214,16 +394,28 @@ struct TokenStream
    */
   [[nodiscard]] auto construct() const noexcept -> std::string
   {
-    std::stringstream ss {};
+    std::string result {};
+    construct_into(result);
+    return result;
+  }
 
-    std::size_t offset {0};   
-    while (!is_at_end(offset))
-    {
-     ss << peek(offset).lexeme;
-     offset++;
-    }
+  /**
+   * Append the string form of the view to `out`, which is grown once to the exact size.
+   */
+  template <typename String>
+  auto construct_into(String& out) const -> void
+  {
+    if (m_target == nullptr) return;
+    m_target->construct_into(out, m_current_pointer, end_index());
+  }
 
-    return ss.str();
+  /**
+   * Write the string form of the view to the stream, without building a string.
+   */
+  auto write_to(std::ostream& os) const -> void
+  {
+    if (m_target == nullptr) return;
+    m_target->write_to(os, m_current_pointer, end_index());
   }
 
   /**
@@ -234,7 +426,7 @@ struct TokenStream
   {
    std::size_t offset {0};
 
-   while (!peek(offset).is(token_type))
+   while (peek_type(offset) != token_type)
    {
     offset++;
    }
@@ -254,7 +446,7 @@ struct TokenStream
   {
    std::size_t offset {0};
 
-   while (!peek(offset).is(token_type))
+   while (peek_type(offset) != token_type)
    {
     offset++;
    }
@@ -273,7 +465,7 @@ struct TokenStream
    // Find the next pair/scope.
    if (!in_scope) 
    {
-    while (!peek(start_offset).is(head)) 
+    while (peek_type(start_offset) != head) 
     {
      start_offset++;
     }
@@ -281,17 +473,32 @@ struct TokenStream
     offset = start_offset;
    }
 
+   // The head sits just before the scope, so the closing bracket can be looked up. The scope
+   // still ends early at the end of the view or at an EndOfFile token, as the walk below does.
+   const auto scope_start = m_current_pointer + start_offset;
+   if (m_target != nullptr && TokenStream::is_bracket_pair(head, tail) && scope_start > 0 &&
+       scope_start <= m_target->size() && m_target->type_at(scope_start - 1) == head)
+   {
+    const auto limit = std::min(m_max_size, m_target->next_end_of_file(scope_start));
+    const auto close = std::min(m_target->matching_bracket(scope_start - 1), limit);
+    return TokenStreamView {
+      scope_start,                     // Start
+      std::max(close, scope_start),    // Size
+      m_target
+    };
+   }
+
    std::size_t scope = 1;
 
-   while (!peek(offset).is(TokenType::EndOfFile))
+   while (peek_type(offset) != TokenType::EndOfFile)
    {
-    const auto tok = peek(offset);
+    const auto type = peek_type(offset);
 
-    if (tok.is(head))
+    if (type == head)
     {
      scope++;
     }
-    else if (tok.is(tail))
+    else if (type == tail)
     {
      scope--;
 
@@ -308,6 +515,17 @@ struct TokenStream
    };
  }
 
+ /**
+  * Move past the tail which closes the current scope (the head has already been passed), or to
+  * the end of the view if the scope is never closed.
+  */
+ auto skip_scope(TokenType head, TokenType tail) -> void
+ {
+  const auto scope = between(head, tail);
+  m_current_pointer += scope.remaining_size();
+  static_cast<void>(consume(tail));
+ }
+
  /**
   * Is at end.
   */
@@ -317,6 +535,14 @@ struct TokenStream
  }
 
  private:
+  /**
+   * One past the last index of the view in the underlying stream.
+   */
+  [[nodiscard]] auto end_index() const noexcept -> std::size_t
+  {
+   return std::max(m_current_pointer, std::min(m_max_size, m_target->size()));
+  }
+
   /**
    * Members.
    */
@@ -324,12 +550,35 @@ struct TokenStream
   std::size_t        m_current_pointer {0};
   std::size_t        m_initial_start_pointer {0};
   const TokenStream* m_target {nullptr};
-
-  inline static Token m_eof_token = Token();
  };
 
  using View = TokenStreamView;
 
+ /**
+  * Constructors.
+  */
+
+ TokenStream() = default;
+
+ /**
+  * Construct an empty stream whose arrays are allocated from `resource`. The resource must
+  * outlive the stream. Buffers of pushed tokens are still pinned with shared ownership, so
+  * tokens copied out of the stream do not depend on the resource.
+  */
+ explicit TokenStream(std::pmr::memory_resource* resource)
+ : m_types{resource}
+ , m_offsets{resource}
+ , m_lengths{resource}
+ , m_sources{resource}
+ , m_partners{resource}
+ , m_open_brackets{{std::pmr::vector<std::uint32_t>{resource}, std::pmr::vector<std::uint32_t>{resource},
+                    std::pmr::vector<std::uint32_t>{resource}}}
+ , m_end_of_files{resource}
+ , m_symbols{resource}
+ , m_buffers{resource}
+ {
+ }
+
 
  /**
   * Methods.
@@ -340,20 +589,92 @@ struct TokenStream
   */
  [[nodiscard]] auto construct() const noexcept-> std::string
  {
-  std::stringstream ss;
-  std::for_each(std::begin(m_tokens), std::end(m_tokens), [&](const Token& tok) {
-   ss << tok.lexeme;
-  });
-  return ss.str();
+  std::string result {};
+  construct_into(result, 0, size());
+  return result;
+ }
+
+ /**
+  * Returns the number of bytes in the lexemes of the tokens in [begin, end).
+  */
+ [[nodiscard]] auto byte_size(std::size_t begin, std::size_t end) const noexcept -> std::size_t
+ {
+  std::size_t bytes {0};
+  for (auto index = begin; index < end; ++index) bytes += m_lengths[index];
+  return bytes;
+ }
+
+ /**
+  * Append the lexemes of the tokens in [begin, end) to `out`, growing it once to the exact size.
+  */
+ template <typename String>
+ auto construct_into(String& out, std::size_t begin, std::size_t end) const -> void
+ {
+  out.reserve(out.size() + byte_size(begin, end));
+  for (auto index = begin; index < end; ++index)
+  {
+   if (m_lengths[index] != 0) out.append(get(index).lexeme);
+  }
+ }
+
+ /**
+  * Write the lexemes of the tokens in [begin, end) to the stream.
+  */
+ auto write_to(std::ostream& os, std::size_t begin, std::size_t end) const -> void
+ {
+  if (const auto contiguous = contiguous_view(begin, end))
+  {
+   os.write(contiguous->data(), static_cast<std::streamsize>(contiguous->size()));
+   return;
+  }
+
+  for (auto index = begin; index < end; ++index)
+  {
+   const auto lexeme = get(index).lexeme;
+   os.write(lexeme.data(), static_cast<std::streamsize>(lexeme.size()));
+  }
+ }
+
+ /**
+  * If the lexemes of the tokens in [begin, end) are adjacent slices of one source buffer (e.g.
+  * an untouched range of the original file), returns them as a single view of that buffer.
+  */
+ [[nodiscard]] auto contiguous_view(std::size_t begin, std::size_t end) const noexcept
+     -> std::optional<std::string_view>
+ {
+  const SourceBuffer* buffer {nullptr};
+  std::size_t         first {0}, next {0};
+
+  for (auto index = begin; index < end; ++index)
+  {
+   // Empty lexemes (e.g. EndOfFile) fit anywhere.
+   if (m_lengths[index] == 0) continue;
+
+   const auto* source = m_buffers[m_sources[index]].get();
+   if (buffer == nullptr)
+   {
+    buffer = source;
+    first  = next = m_offsets[index];
+   }
+   else if (source != buffer || m_offsets[index] != next)
+   {
+    return {};
+   }
+   next += m_lengths[index];
+  }
+
+  if (buffer == nullptr) return std::string_view{};
+  return buffer->view().substr(first, next - first);
  }
 
  /**
   * Add the string into the token stream.
   */
- auto add_string(const std::string& input) -> void
+ auto add_string(std::string_view input) -> void
  {
    Scanner scanner;
    scanner.set_source(input);
+   pin(scanner.buffer());
    while (!scanner.is_at_end())
    {
     push_back(scanner.scan_token());
@@ -363,34 +684,61 @@ struct TokenStream
  /**
   * Returns the token at the specified index.
   */
- [[nodiscard]] auto at(std::size_t index) const -> const Token&
+ [[nodiscard]] auto at(std::size_t index) const -> Token
+ {
+  static_cast<void>(m_types.at(index));
+  return get(index);
+ }
+
+ /**
+  * Returns the token at the specified index, without bounds checking. The token is assembled
+  * from the arrays, prefer type_at() when only the type is needed.
+  */
+ [[nodiscard]] auto get(std::size_t index) const noexcept -> Token
  {
-  return m_tokens.at(index);
+  const auto source = m_sources[index];
+  if (source == no_source) return Token(m_types[index], {}, nullptr);
+
+  const auto* buffer = m_buffers[source].get();
+  return Token(m_types[index], std::string_view(buffer->view().data() + m_offsets[index], m_lengths[index]), buffer);
  }
 
- [[nodiscard]] auto at(std::size_t index) -> Token&
+ /**
+  * Returns the type of the token at the specified index, without bounds checking.
+  */
+ [[nodiscard]] auto type_at(std::size_t index) const noexcept -> TokenType
  {
-  return m_tokens.at(index);
+  return m_types[index];
  }
 
  /**
-  * Construct a token stream from string input.
+  * Construct a token stream from string input, with its arrays allocated from `resource`.
   */
- static auto from_string(const std::string& input) -> TokenStream
+ static auto from_string(std::string_view input,
+                         std::pmr::memory_resource* resource = std::pmr::get_default_resource()) -> TokenStream
  {
-  TokenStream<TokenType> t;
+  TokenStream<TokenType> t{resource};
   t.add_string(input);
   return t;
  }
 
  /**
-  * Construct a token stream from file content.
+  * Construct a token stream from file content. Large files are scanned in parallel when more
+  * than one hardware thread is available.
   */
  static auto from_file(const std::string& path) -> TokenStream
  {
   TokenStream ts{};
   Scanner scanner{};
   if (!scanner.read_source(path)) return ts;
+  ts.pin(scanner.buffer());
+
+  if (scanner.buffer()->view().size() >= parallel_scan_threshold && std::thread::hardware_concurrency() > 1)
+  {
+    ts.scan_parallel(scanner.buffer(), std::thread::hardware_concurrency());
+    return ts;
+  }
+
   while (!scanner.is_at_end())
   {
     ts.push_back(scanner.scan_token());
@@ -398,83 +746,1318 @@ struct TokenStream
   return ts;
  }
 
+ /**
+  * Construct a token stream from file content, scanned on the given number of threads. The
+  * result is identical to a serial scan.
+  */
+ static auto from_file_parallel(const std::string& path, std::size_t thread_count) -> TokenStream
+ {
+  TokenStream ts{};
+  Scanner scanner{};
+  if (!scanner.read_source(path)) return ts;
+  ts.pin(scanner.buffer());
+  ts.scan_parallel(scanner.buffer(), thread_count);
+  return ts;
+ }
+
+ /**
+  * Scan the whole buffer on `thread_count` threads, appending the tokens to the stream, see
+  * ParallelScan. The buffer is scanned in batches of parallel_batch_size bytes per thread, which
+  * keeps the tokens waiting to be appended in cache.
+  */
+ auto scan_parallel(const std::shared_ptr<const SourceBuffer>& buffer, std::size_t thread_count) -> void
+ {
+  ParallelScan<TokenType> scan {buffer, thread_count};
+  const auto              size  = buffer->view().size();
+  const auto              batch = std::max<std::size_t>(thread_count, 1) * parallel_batch_size;
+
+  for (std::size_t begin {0}; begin < size;)
+  {
+   const auto end = scan.line_start_after(begin + batch);
+   scan.scan(begin, end, [this](const Token& token) { push_back(token); });
+   begin = end;
+  }
+
+  if (const auto end = scan.end_token()) push_back(*end);
+ }
+
  static auto from_file_raw(const std::string& path) -> TokenStream
  {
   TokenStream ts{};
   Scanner scanner{};
   if (!scanner.read_source(path)) return ts;
+  ts.pin(scanner.buffer());
   while (!scanner.is_at_end())
   {
-    const auto token = scanner.scan_raw();
-    ts.push_back(token);
+    ts.push_back(scanner.scan_raw());
   }
   return ts;
  }
 
  /**
-  * Push the token to the back of the token stream.
+  * Push the token to the back of the token stream. The token's source buffer is pinned, a
+  * token without a source has its lexeme copied into a buffer of its own.
+  *
+  * NOTE: Offsets and lengths are stored in 32 bits, source buffers are limited to 4 GiB.
   */
  auto push_back(Token tok) -> void
  {
-   m_tokens.push_back(tok);
+   if (tok.source == nullptr && !tok.lexeme.empty())
+   {
+    tok = make_owned(tok.type, std::string(tok.lexeme));
+   }
+
+   std::uint32_t source {no_source};
+   std::uint32_t offset {0};
+
+   if (tok.source != nullptr)
+   {
+    if (tok.source != m_last_pinned)
+    {
+     pin(tok.source->shared_from_this());
+    }
+    source = m_last_index;
+    offset = static_cast<std::uint32_t>(tok.lexeme.data() - tok.source->view().data());
+   }
+
+   m_types.push_back(tok.type);
+   m_offsets.push_back(offset);
+   m_lengths.push_back(static_cast<std::uint32_t>(tok.lexeme.size()));
+   m_sources.push_back(source);
+   m_partners.push_back(no_source);
+   track_scopes(size() - 1);
  }
 
  /**
-  * Return the token at the back of the stream. Offset defaulted to 0.
+  * Push the tokens in [begin, end) of another stream to the back of this one. The arrays are
+  * copied in bulk, only the buffer of each token is looked up, once per run of tokens which
+  * share it.
+  *
+  * NOTE: The other stream must not be this one.
   */
- auto peek_back(std::size_t offset = 0) -> Token
+ auto append(const TokenStream& other, std::size_t begin, std::size_t end) -> void
  {
-  if (static_cast<int>(m_tokens.size()) - (static_cast<int>(offset) + 1) < 0)
-   return Token();
-  return m_tokens[m_tokens.size() - (offset + 1)];
+   if (begin >= end) return;
+
+   const auto first = size();
+   m_types.insert(m_types.end(), other.m_types.begin() + begin, other.m_types.begin() + end);
+   m_offsets.insert(m_offsets.end(), other.m_offsets.begin() + begin, other.m_offsets.begin() + end);
+   m_lengths.insert(m_lengths.end(), other.m_lengths.begin() + begin, other.m_lengths.begin() + end);
+
+   // Sources index the buffers of the other stream, they are pinned here and renumbered.
+   std::uint32_t from {no_source};
+   std::uint32_t to {no_source};
+   for (auto index = begin; index < end; ++index)
+   {
+    const auto source = other.m_sources[index];
+    if (source != no_source && source != from)
+    {
+     if (other.m_buffers[source].get() != m_last_pinned)
+     {
+      pin(other.m_buffers[source]);
+     }
+     from = source;
+     to   = m_last_index;
+    }
+    m_sources.push_back(source == no_source ? no_source : to);
+   }
+
+   m_partners.resize(size(), no_source);
+   for (auto index = first; index < size(); ++index) track_scopes(index);
  }
 
  /**
-  * Pop the last element.
+  * Returns a copy of the tokens in [begin, end) whose lexemes are moved into one buffer owned by
+  * the copy, so the copy does not keep the buffers of this stream alive.
   */
- auto pop_back() -> void
+ [[nodiscard]] auto detach(std::size_t begin, std::size_t end) const -> TokenStream
  {
-   m_tokens.pop_back();
+   std::string text {};
+   for (auto index = begin; index < end; ++index)
+   {
+    if (m_lengths[index] != 0) text.append(get(index).lexeme);
+   }
+
+   TokenStream copy {};
+   copy.pin(SourceBuffer::from_string(std::move(text)));
+   copy.reserve(end - begin);
+
+   std::uint32_t offset {0};
+   for (auto index = begin; index < end; ++index)
+   {
+    copy.m_types.push_back(m_types[index]);
+    copy.m_offsets.push_back(offset);
+    copy.m_lengths.push_back(m_lengths[index]);
+    copy.m_sources.push_back(m_sources[index] == no_source ? no_source : 0);
+    copy.m_partners.push_back(no_source);
+    copy.track_scopes(copy.size() - 1);
+    offset += m_lengths[index];
+   }
+   return copy;
  }
 
  /**
-  * Return the size of the token stream.
+  * Returns the approximate number of bytes held by the stream: its token arrays and the
+  * buffers it pins.
   */
- [[nodiscard]] auto size() const noexcept -> std::size_t
+ [[nodiscard]] auto footprint() const noexcept -> std::size_t
  {
-  return m_tokens.size();
+   constexpr std::size_t token_bytes {sizeof(TokenType) + 4 * sizeof(std::uint32_t)};
+
+   std::size_t bytes {size() * token_bytes};
+   for (const auto& buffer : m_buffers) bytes += buffer->view().size();
+   return bytes;
  }
 
  /**
-  * Returns whether the token stream is empty.
+  * Reserve space for the given number of tokens.
   */
- [[nodiscard]] auto empty() const noexcept -> bool 
+ auto reserve(std::size_t count) -> void
  {
-  return m_tokens.empty();
+   m_types.reserve(count);
+   m_offsets.reserve(count);
+   m_lengths.reserve(count);
+   m_sources.reserve(count);
+   m_partners.reserve(count);
  }
 
  /**
-  * Returns an immutable view into the TokenStream.
-  *
-  * WARN: Do not mutate the TokenStream while a view is active.
+  * Returns the index of the bracket matching the one at the given index (in either direction),
+  * or `no_match` if it is not a bracket or is unmatched. Each kind of bracket is matched on its
+  * own, the same way between() counts only its head and tail.
   */
- [[nodiscard]] auto get_view() const noexcept -> TokenStreamView
+ [[nodiscard]] auto matching_bracket(std::size_t index) const noexcept -> std::size_t
  {
-   return TokenStreamView(this);
+  const auto partner = m_partners[index];
+  return partner == no_source ? no_match : partner;
  }
 
  /**
-  * Clear the token stream view.
+  * Returns the index of the first EndOfFile token at or after the given index, or size() if
+  * there is none.
   */
- auto clear() noexcept -> void 
+ [[nodiscard]] auto next_end_of_file(std::size_t index) const noexcept -> std::size_t
  {
-   m_tokens.clear();
+  const auto found = std::lower_bound(m_end_of_files.begin(), m_end_of_files.end(), index);
+  return found == m_end_of_files.end() ? size() : *found;
  }
 
  /**
-  * Members.
+  * Returns true if a bracket of the kind opened by `head` has been pushed and not yet closed.
+  */
+ [[nodiscard]] auto has_unclosed(TokenType head) const noexcept -> bool
+ {
+  for (std::size_t kind {0}; kind < bracket_pairs.size(); ++kind)
+  {
+   if (bracket_pairs[kind].first == head) return !m_open_brackets[kind].empty();
+  }
+  return false;
+ }
+
+ /**
+  * Returns true if the types are the opening and closing bracket of one kind.
+  */
+ [[nodiscard]] static constexpr auto is_bracket_pair(TokenType head, TokenType tail) noexcept -> bool
+ {
+  return std::find(bracket_pairs.begin(), bracket_pairs.end(), std::pair{head, tail}) != bracket_pairs.end();
+ }
+
+ /**
+  * Returns true if the type is an opening bracket.
+  */
+ [[nodiscard]] static constexpr auto is_opening_bracket(TokenType type) noexcept -> bool
+ {
+  return std::any_of(bracket_pairs.begin(), bracket_pairs.end(), [type](const auto& pair) { return pair.first == type; });
+ }
+
+ /**
+  * Create a token with a lexeme which is not a slice of any existing source (e.g. joined
+  * identifiers). The lexeme is moved into a buffer pinned by this stream, the returned token
+  * stays valid for as long as the stream is alive.
+  */
+ [[nodiscard]] auto make_owned(TokenType type, std::string lexeme) -> Token
+ {
+   const auto buffer = SourceBuffer::from_string(std::move(lexeme));
+   pin(buffer);
+   return Token(type, buffer->view(), buffer.get());
+ }
+
+ /**
+  * Keep the buffer alive for the lifetime of the stream.
+  *
+  * NOTE: Only the most recent pins are checked for duplicates. Tokens tend to arrive in runs
+  *       from the same buffer, and pinning a buffer twice is harmless.
+  */
+ auto pin(const std::shared_ptr<const SourceBuffer>& buffer) -> void
+ {
+   if (buffer == nullptr) return;
+   m_last_pinned = buffer.get();
+
+   constexpr std::size_t recent_pins {8};
+   const auto            recent_begin = m_buffers.size() > recent_pins ? m_buffers.end() - recent_pins : m_buffers.begin();
+   const auto            found        = std::find(recent_begin, m_buffers.end(), buffer);
+   if (found == m_buffers.end())
+   {
+    m_buffers.push_back(buffer);
+    m_last_index = static_cast<std::uint32_t>(m_buffers.size() - 1);
+   }
+   else
+   {
+    m_last_index = static_cast<std::uint32_t>(found - m_buffers.begin());
+   }
+ }
+
+ /**
+  * Iterates over the tokens, which are assembled from the arrays on access.
   */
- std::vector<Token> m_tokens;
+ class ConstIterator
+ {
+ public:
+  using iterator_category = std::forward_iterator_tag;
+  using value_type        = Token;
+  using difference_type   = std::ptrdiff_t;
+  using pointer           = void;
+  using reference         = Token;
+
+  ConstIterator() = default;
+
+  ConstIterator(const TokenStream* ts, std::size_t index)
+  : m_target{ts}
+  , m_index{index}
+  {
+  }
+
+  [[nodiscard]] auto operator*() const noexcept -> Token
+  {
+   return m_target->get(m_index);
+  }
+
+  auto operator++() noexcept -> ConstIterator&
+  {
+   ++m_index;
+   return *this;
+  }
+
+  auto operator++(int) noexcept -> ConstIterator
+  {
+   auto previous = *this;
+   ++m_index;
+   return previous;
+  }
+
+  [[nodiscard]] auto operator==(const ConstIterator& other) const noexcept -> bool = default;
+
+ private:
+  const TokenStream* m_target {nullptr};
+  std::size_t        m_index {0};
+ };
+
+ /**
+  * Iterators.
+  */
+ [[nodiscard]] auto begin() const noexcept { return ConstIterator(this, 0); }
+ [[nodiscard]] auto end() const noexcept { return ConstIterator(this, size()); }
+
+ /**
+  * Return the token at the back of the stream. Offset defaulted to 0.
+  */
+ auto peek_back(std::size_t offset = 0) -> Token
+ {
+  if (static_cast<int>(size()) - (static_cast<int>(offset) + 1) < 0)
+   return Token();
+  return get(size() - (offset + 1));
+ }
+
+ /**
+  * Pop the last element.
+  */
+ auto pop_back() -> void
+ {
+   untrack_scopes();
+   m_types.pop_back();
+   m_offsets.pop_back();
+   m_lengths.pop_back();
+   m_sources.pop_back();
+   m_partners.pop_back();
+   if (m_symbols.size() > size()) m_symbols.pop_back();
+ }
+
+ /**
+  * Return the size of the token stream.
+  */
+ [[nodiscard]] auto size() const noexcept -> std::size_t
+ {
+  return m_types.size();
+ }
+
+ /**
+  * Returns whether the token stream is empty.
+  */
+ [[nodiscard]] auto empty() const noexcept -> bool 
+ {
+  return m_types.empty();
+ }
+
+ /**
+  * Returns an immutable view into the TokenStream.
+  *
+  * WARN: Do not mutate the TokenStream while a view is active.
+  */
+ [[nodiscard]] auto get_view() const noexcept -> TokenStreamView
+ {
+   return TokenStreamView(this);
+ }
+
+ /**
+  * Clear the token stream view.
+  *
+  * NOTE: Pinned buffers are kept, tokens previously read from this stream remain valid.
+  */
+ auto clear() noexcept -> void 
+ {
+   m_types.clear();
+   m_offsets.clear();
+   m_lengths.clear();
+   m_sources.clear();
+   m_partners.clear();
+   m_end_of_files.clear();
+   m_symbols.clear();
+   for (auto& open : m_open_brackets) open.clear();
+ }
+
+ /**
+  * Clear the token stream and unpin its buffers. The arrays keep their capacity, so the stream
+  * can be reused without holding on to the sources of its previous tokens.
+  */
+ auto reset() noexcept -> void
+ {
+   clear();
+   m_buffers.clear();
+   m_last_pinned = nullptr;
+   m_last_index  = no_source;
+ }
+
+ /**
+  * Intern the lexeme of every identifier and number in the stream, and record their symbols.
+  */
+ auto intern_symbols(SymbolTable& symbols) -> void
+ {
+   assign_symbols([&symbols](std::string_view lexeme) { return symbols.intern(lexeme); });
+ }
+
+ /**
+  * Record the symbol of every identifier and number in the stream whose lexeme is interned in
+  * the table. The table is not modified, other lexemes get `no_symbol`.
+  */
+ auto resolve_symbols(const SymbolTable& symbols) -> void
+ {
+   assign_symbols([&symbols](std::string_view lexeme) { return symbols.find(lexeme); });
+ }
+
+ /**
+  * Returns the symbol recorded for the token at the given index, or `no_symbol` if the token is
+  * not an identifier or number, or was pushed after symbols were last recorded.
+  */
+ [[nodiscard]] auto symbol_at(std::size_t index) const noexcept -> Symbol
+ {
+   return index < m_symbols.size() ? m_symbols[index] : no_symbol;
+ }
+
+ /**
+  * Returns true if symbols have been recorded for all tokens before `end`.
+  */
+ [[nodiscard]] auto has_symbols(std::size_t end) const noexcept -> bool
+ {
+   return m_symbols.size() >= end;
+ }
+
+ /**
+  * Record a symbol for each token, computed by `symbol_of` from the lexeme of identifiers and
+  * numbers.
+  */
+ template <typename SymbolOf>
+ auto assign_symbols(SymbolOf&& symbol_of) -> void
+ {
+   m_symbols.assign(size(), no_symbol);
+   for (std::size_t index {0}; index < size(); ++index)
+   {
+    if (m_types[index] == TokenType::Identifier || m_types[index] == TokenType::Number)
+    {
+     m_symbols[index] = symbol_of(get(index).lexeme);
+    }
+   }
+ }
+
+ /**
+  * Record the token at the index, the first not yet recorded, in the bracket table.
+  */
+ auto track_scopes(std::size_t position) -> void
+ {
+  const auto index = static_cast<std::uint32_t>(position);
+  const auto type  = m_types[position];
+
+  if (type == TokenType::EndOfFile)
+  {
+   m_end_of_files.push_back(index);
+   return;
+  }
+
+  for (std::size_t kind {0}; kind < bracket_pairs.size(); ++kind)
+  {
+   auto& open = m_open_brackets[kind];
+   if (type == bracket_pairs[kind].first)
+   {
+    open.push_back(index);
+   }
+   else if (type == bracket_pairs[kind].second && !open.empty())
+   {
+    m_partners[open.back()] = index;
+    m_partners[index]       = open.back();
+    open.pop_back();
+   }
+  }
+ }
+
+ /**
+  * Remove the last token from the bracket table, undoing track_scopes().
+  */
+ auto untrack_scopes() -> void
+ {
+  const auto index   = static_cast<std::uint32_t>(size() - 1);
+  const auto type    = m_types.back();
+  const auto partner = m_partners.back();
+
+  if (type == TokenType::EndOfFile)
+  {
+   m_end_of_files.pop_back();
+   return;
+  }
+
+  for (std::size_t kind {0}; kind < bracket_pairs.size(); ++kind)
+  {
+   auto& open = m_open_brackets[kind];
+   if (type == bracket_pairs[kind].first && !open.empty() && open.back() == index)
+   {
+    open.pop_back();
+   }
+   else if (type == bracket_pairs[kind].second && partner != no_source)
+   {
+    m_partners[partner] = no_source;
+    open.push_back(partner);
+   }
+  }
+ }
+
+ /**
+  * Files of at least this many bytes are scanned in parallel by from_file and
+  * LazyTokenStream::from_file.
+  */
+ static constexpr std::size_t parallel_scan_threshold {std::size_t{1} << 22};
+
+ /**
+  * Bytes of the source scanned per thread and batch by a parallel scan.
+  */
+ static constexpr std::size_t parallel_batch_size {std::size_t{1} << 18};
+
+ /**
+  * Returned by matching_bracket() for tokens without a matching bracket.
+  */
+ static constexpr std::size_t no_match {SIZE_MAX};
+
+ /**
+  * Members.
+  *
+  * Tokens are stored as parallel arrays, so passes which only look at token types (matching,
+  * skipping, scope search) read one byte per token. The lexeme of token `i` is
+  * `m_lengths[i]` bytes at `m_offsets[i]` in `m_buffers[m_sources[i]]`.
+  */
+ std::pmr::vector<TokenType>     m_types;
+ std::pmr::vector<std::uint32_t> m_offsets;
+ std::pmr::vector<std::uint32_t> m_lengths;
+ std::pmr::vector<std::uint32_t> m_sources;
+
+ // Source index of tokens which have no lexeme and no source (e.g. a default EndOfFile). Also
+ // marks tokens without a partner in m_partners.
+ static constexpr std::uint32_t no_source {UINT32_MAX};
+
+ // Bracket table, built as tokens are pushed. m_partners holds the index of the matching
+ // bracket of every matched bracket, m_open_brackets the brackets of each kind still waiting
+ // for a match and m_end_of_files the index of every EndOfFile token, which ends any scope.
+ static constexpr std::array<std::pair<TokenType, TokenType>, 3> bracket_pairs {{
+  {TokenType::LParen, TokenType::RParen},
+  {TokenType::LSquare, TokenType::RSquare},
+  {TokenType::LBrace, TokenType::RBrace},
+ }};
+
+ std::pmr::vector<std::uint32_t>                m_partners;
+ std::array<std::pmr::vector<std::uint32_t>, 3> m_open_brackets;
+ std::pmr::vector<std::uint32_t>                m_end_of_files;
+
+ // Symbols of the identifiers and numbers, recorded on request by intern_symbols() or
+ // resolve_symbols(). Empty until then.
+ std::pmr::vector<Symbol> m_symbols;
+
+ // Buffers referenced by the tokens above.
+ std::pmr::vector<std::shared_ptr<const SourceBuffer>> m_buffers;
+ const SourceBuffer*                                   m_last_pinned {nullptr};
+ std::uint32_t                                         m_last_index {no_source};
+};
+
+/**
+ * A view of a MactenAllToken stream as the MactenToken stream the same source scans to: spaces
+ * and newlines are skipped and every other token is retyped on the fly. This lets a single
+ * scan serve both token sets, no string is constructed and nothing is rescanned.
+ *
+ * The interface mirrors the parts of TokenStreamView used for pattern matching.
+ */
+class MactenTokenView
+{
+ public:
+ using Token = cpp20scanner::Token<MactenToken>;
+ using AllTokenStream = TokenStream<MactenAllToken>;
+
+ /**
+  * View the remainder of the given MactenAllToken view.
+  */
+ explicit MactenTokenView(const AllTokenStream::TokenStreamView& view)
+ : MactenTokenView(view.target(), view.position(), view.size())
+ {
+ }
+
+ /**
+  * View the MactenAllTokens in [start, end) of the given stream.
+  *
+  * NOTE: Tokens are counted as they are walked, constructing a view of a long tail is O(1).
+  */
+ MactenTokenView(const AllTokenStream* ts, std::size_t start, std::size_t end)
+ : m_target{ts}
+ , m_current{start}
+ , m_end{ts == nullptr ? start : std::min(end, ts->size())}
+ {
+  skip_filtered();
+ }
+
+ /**
+  * Returns true when the view has been exhausted.
+  */
+ [[nodiscard]] auto is_at_end(std::size_t offset = 0) const noexcept -> bool
+ {
+  return index_of(offset) >= m_end;
+ }
+
+ /**
+  * Returns the top Token with an offset.
+  *
+  * NOTE: If the offset is past the end of the view, EndOfFile will be returned.
+  */
+ [[nodiscard]] auto peek(std::size_t offset = 0) const noexcept -> Token
+ {
+  const auto index = index_of(offset);
+  if (index >= m_end) return Token();
+
+  return convert(m_target->get(index));
+ }
+
+ /**
+  * Returns the type of the top Token with an offset.
+  */
+ [[nodiscard]] auto peek_type(std::size_t offset = 0) const noexcept -> MactenToken
+ {
+  return peek(offset).type;
+ }
+
+ /**
+  * Returns true if the top token is the same as `expected`.
+  */
+ [[nodiscard]] auto front_is(MactenToken expected) const noexcept -> bool
+ {
+  return peek().is(expected);
+ }
+
+ /**
+  * Returns true if the given sequence is found, starting from the top.
+  */
+ template <std::same_as<MactenToken>... TokenTypes>
+ [[nodiscard]] auto match_sequence(TokenTypes... tokens) const noexcept -> bool
+ {
+  std::size_t offset {0};
+  return ((peek(offset++).type == tokens) && ...);
+ }
+
+ /**
+  * Returns the top element and increment the pointer.
+  */
+ [[nodiscard]] auto pop() noexcept -> Token
+ {
+  const auto token = peek();
+  advance();
+  return token;
+ }
+
+ /**
+  * Advance the pointer.
+  */
+ auto advance(std::size_t steps = 1) noexcept -> void
+ {
+  for (; steps > 0 && m_current < m_end; --steps)
+  {
+   ++m_current;
+   skip_filtered();
+  }
+ }
+
+ /**
+  * Return the remaining size of the view. The tokens are counted, this is linear in the size.
+  */
+ [[nodiscard]] auto remaining_size() const noexcept -> std::size_t
+ {
+  std::size_t count {0};
+  for (auto index = m_current; index < m_end; ++index)
+  {
+   if (!is_skipped(m_target->type_at(index))) count++;
+  }
+  return count;
+ }
+
+ /**
+  * Retrieve the view of the scope created by the head/tail pair.
+  * Note: You are expected to have passed the head token when this is called.
+  */
+ auto between(MactenToken head, MactenToken tail) const noexcept -> MactenTokenView
+ {
+  std::size_t scope {1};
+  auto        index = m_current;
+
+  for (; index < m_end; ++index)
+  {
+   if (is_skipped(m_target->type_at(index))) continue;
+
+   const auto type = convert(m_target->get(index)).type;
+   if (type == MactenToken::EndOfFile) break;
+
+   if (type == head)
+   {
+    scope++;
+   }
+   else if (type == tail && --scope == 0)
+   {
+    break;
+   }
+  }
+
+  return MactenTokenView{m_target, m_current, index};
+ }
+
+ /**
+  * Is at end.
+  */
+ [[nodiscard]] auto is_exhausted() const noexcept -> bool 
+ {
+  return front_is(MactenToken::EndOfFile);
+ }
+
+ /**
+  * Returns the index of the top token in the underlying stream, or the end of the view once
+  * it is exhausted.
+  */
+ [[nodiscard]] auto position() const noexcept -> std::size_t
+ {
+  return m_current;
+ }
+
+ /**
+  * Returns the index in the underlying stream at which the view ends.
+  */
+ [[nodiscard]] auto end() const noexcept -> std::size_t
+ {
+  return m_end;
+ }
+
+ /**
+  * Returns the stream being viewed.
+  */
+ [[nodiscard]] auto target() const noexcept -> const AllTokenStream*
+ {
+  return m_target;
+ }
+
+ /**
+  * Returns the symbol of the top token, see TokenStream::symbol_at().
+  */
+ [[nodiscard]] auto peek_symbol() const noexcept -> Symbol
+ {
+  return is_at_end() ? no_symbol : m_target->symbol_at(m_current);
+ }
+
+ /**
+  * Retype a MactenAllToken as the MactenToken its lexeme scans to. Symbols and errors are
+  * single characters, so they are looked up in the MactenToken symbol table directly.
+  */
+ [[nodiscard]] static auto convert(const cpp20scanner::Token<MactenAllToken>& token) noexcept -> Token
+ {
+  using Scanner = MactenToken::Scanner;
+
+  MactenToken type {MactenToken::Error};
+
+  if (token.is(MactenAllToken::Identifier) || token.type.is_keyword())
+   type = Scanner::keywords.find(token.lexeme).value_or(MactenToken::Identifier);
+  else if (token.is(MactenAllToken::Number))
+   type = MactenToken::Number;
+  else if (token.is(MactenAllToken::EndOfFile))
+   type = MactenToken::EndOfFile;
+  else if (token.is(MactenAllToken::Raw))
+   type = MactenToken::Raw;
+  else if (!token.lexeme.empty())
+   type = Scanner::symbol_types[static_cast<unsigned char>(token.lexeme.front())];
+
+  return Token(type, token.lexeme, token.source);
+ }
+
+ private:
+ /**
+  * MactenToken ignores spaces and newlines.
+  */
+ [[nodiscard]] static auto is_skipped(MactenAllToken type) noexcept -> bool
+ {
+  return type == MactenAllToken::Space || type == MactenAllToken::Newline;
+ }
+
+ /**
+  * Move the pointer onto the next token which is not skipped.
+  */
+ auto skip_filtered() noexcept -> void
+ {
+  while (m_current < m_end && is_skipped(m_target->type_at(m_current))) ++m_current;
+ }
+
+ /**
+  * Returns the index in the underlying stream of the token `offset` tokens past the top, or the
+  * end of the view if there are not that many.
+  */
+ [[nodiscard]] auto index_of(std::size_t offset) const noexcept -> std::size_t
+ {
+  auto index = m_current;
+  while (index < m_end && offset > 0)
+  {
+   ++index;
+   while (index < m_end && is_skipped(m_target->type_at(index))) ++index;
+   --offset;
+  }
+  return index;
+ }
+
+ /**
+  * Members.
+  */
+ const AllTokenStream* m_target {nullptr};
+ std::size_t           m_current {0};
+ std::size_t           m_end {0};
+};
+
+/**
+ * A token sequence assembled from slices of other token streams. Appending a range of a stream
+ * records the slice rather than copying its tokens, so splicing expansions in between untouched
+ * ranges of the source costs one slice per splice instead of a copy of every token. Tokens which
+ * are not part of any stream are pushed into a stream owned by the rope. The sequence is only
+ * flattened when it is written out.
+ *
+ * WARN: The rope does not own the streams it slices. They must outlive the rope and must not be
+ * cleared or popped while it is in use.
+ */
+template <typename TokenType>
+class TokenRope
+{
+ public:
+ using Token = cpp20scanner::Token<TokenType>;
+ using Stream = TokenStream<TokenType>;
+
+ /**
+  * Append the tokens in [begin, end) of the stream. A range which continues the last slice
+  * extends it.
+  */
+ auto append(const Stream& stream, std::size_t begin, std::size_t end) -> void
+ {
+  if (begin >= end) return;
+
+  const Stream* const source = &stream == &m_owned ? nullptr : &stream;
+  m_size += end - begin;
+
+  if (!m_slices.empty() && m_slices.back().stream == source && m_slices.back().end == begin)
+  {
+   m_slices.back().end = end;
+   return;
+  }
+
+  m_slices.push_back(Slice{source, begin, end});
+ }
+
+ /**
+  * Push a token which is not a slice of any stream held by the rope.
+  */
+ auto push_back(const Token& token) -> void
+ {
+  m_owned.push_back(token);
+  append(m_owned, m_owned.size() - 1, m_owned.size());
+ }
+
+ /**
+  * Push the tokens of the string.
+  */
+ auto add_string(std::string_view input) -> void
+ {
+  splice([input](Stream& stream) { stream.add_string(input); });
+ }
+
+ /**
+  * Create a token with a synthesized lexeme, kept alive by the rope. See TokenStream::make_owned.
+  */
+ [[nodiscard]] auto make_owned(TokenType type, std::string lexeme) -> Token
+ {
+  return m_owned.make_owned(type, std::move(lexeme));
+ }
+
+ /**
+  * Let `write` push tokens into the stream owned by the rope, and append them. Returns what
+  * `write` returns.
+  */
+ template <typename Write>
+ auto splice(Write&& write) -> decltype(write(std::declval<Stream&>()))
+ {
+  const auto begin = m_owned.size();
+
+  if constexpr (std::is_void_v<decltype(write(m_owned))>)
+  {
+   write(m_owned);
+   append(m_owned, begin, m_owned.size());
+  }
+  else
+  {
+   auto result = write(m_owned);
+   append(m_owned, begin, m_owned.size());
+   return result;
+  }
+ }
+
+ /**
+  * Returns the number of tokens.
+  */
+ [[nodiscard]] auto size() const noexcept -> std::size_t
+ {
+  return m_size;
+ }
+
+ /**
+  * Returns true if the rope holds no tokens.
+  */
+ [[nodiscard]] auto is_empty() const noexcept -> bool
+ {
+  return m_size == 0;
+ }
+
+ /**
+  * Write the tokens to the stream, slice by slice. Slices of one source buffer are written
+  * with a single write.
+  */
+ auto write_to(std::ostream& os) const -> void
+ {
+  for (const auto& slice : m_slices)
+  {
+   stream_of(slice).write_to(os, slice.begin, slice.end);
+  }
+ }
+
+ /**
+  * Copy the tokens into a single token stream.
+  */
+ [[nodiscard]] auto flatten() const -> Stream
+ {
+  Stream result {};
+  result.reserve(m_size);
+  for (const auto& slice : m_slices)
+  {
+   result.append(stream_of(slice), slice.begin, slice.end);
+  }
+  return result;
+ }
+
+ /**
+  * Returns the string form of the rope.
+  */
+ [[nodiscard]] auto construct() const -> std::string
+ {
+  std::string result {};
+  for (const auto& slice : m_slices)
+  {
+   stream_of(slice).construct_into(result, slice.begin, slice.end);
+  }
+  return result;
+ }
+
+ private:
+ /**
+  * A range of tokens of a stream. Slices of the owned stream hold no pointer, so the rope can
+  * be moved.
+  */
+ struct Slice
+ {
+  const Stream* stream {nullptr};
+  std::size_t   begin {0};
+  std::size_t   end {0};
+ };
+
+ [[nodiscard]] auto stream_of(const Slice& slice) const noexcept -> const Stream&
+ {
+  return slice.stream == nullptr ? m_owned : *slice.stream;
+ }
+
+ /**
+  * Members.
+  */
+ std::vector<Slice> m_slices;
+ Stream             m_owned;
+ std::size_t        m_size {0};
+};
+
+/**
+ * A forward-only stream which scans tokens on demand, rather than scanning the whole source
+ * up front. Only the tokens which have been peeked at but not yet consumed are held, in a
+ * lookahead buffer, so `peek(n)`, `match_sequence` and `between` work as they do on a
+ * TokenStreamView.
+ *
+ * Tokens returned by pop() and peek() stay valid until the next call to release_consumed(),
+ * push them into a TokenStream to keep them for longer.
+ */
+template <typename TokenType>
+class LazyTokenStream
+{
+ public:
+ /**
+  * Aliases.
+  */
+ using Token = cpp20scanner::Token<TokenType>;
+ using Scanner = typename TokenType::Scanner;
+ using SourceBuffer = cpp20scanner::SourceBuffer;
+
+ /**
+  * Lazily scan from string input.
+  */
+ static auto from_string(std::string_view input) -> LazyTokenStream
+ {
+  LazyTokenStream ts{};
+  ts.m_scanner.set_source(input);
+  return ts;
+ }
+
+ /**
+  * Lazily scan the file content, reading `chunk_size` bytes at a time. Regular files of at least
+  * TokenStream::parallel_scan_threshold bytes are scanned in parallel instead (see
+  * from_file_parallel), when more than one hardware thread is available.
+  */
+ static auto from_file(const std::string& path, std::size_t chunk_size = std::size_t{1} << 16) -> LazyTokenStream
+ {
+  const auto      thread_count = std::thread::hardware_concurrency();
+  std::error_code error {};
+  if (thread_count > 1 && std::filesystem::is_regular_file(path, error))
+  {
+   const auto size = std::filesystem::file_size(path, error);
+   if (!error && size >= TokenStream<TokenType>::parallel_scan_threshold) return from_file_parallel(path, thread_count);
+  }
+
+  LazyTokenStream ts{};
+  if (!ts.m_scanner.open_stream(path, chunk_size)) ts.m_scanner.set_source("");
+  return ts;
+ }
+
+ /**
+  * Lazily scan the file content on `thread_count` threads. The file is mapped whole, and scanned
+  * a batch of `batch_size` bytes per thread at a time whenever the lookahead runs dry, so only
+  * the tokens of one batch are held. The tokens are those of a serial scan, see ParallelScan.
+  */
+ static auto from_file_parallel(const std::string& path,
+                                std::size_t        thread_count,
+                                std::size_t        batch_size = TokenStream<TokenType>::parallel_batch_size) -> LazyTokenStream
+ {
+  LazyTokenStream ts{};
+  ts.m_scanner.set_source("");
+
+  auto buffer = SourceBuffer::from_file(path);
+  if (buffer == nullptr) return ts;
+
+  ts.m_source_size = buffer->view().size();
+  ts.m_batch_size  = std::max<std::size_t>(thread_count, 1) * std::max<std::size_t>(batch_size, 1);
+  ts.m_parallel.emplace(std::move(buffer), thread_count);
+  return ts;
+ }
+
+ /**
+  * Returns true when the stream has been exhausted.
+  */
+ [[nodiscard]] auto is_at_end(std::size_t offset = 0) -> bool
+ {
+  fill(offset + 1);
+  return m_lookahead.size() <= offset;
+ }
+
+ /**
+  * Returns the top Token with an offset.
+  *
+  * NOTE: If the offset is past the end of the stream, EndOfFile will be returned.
+  */
+ [[nodiscard]] auto peek(std::size_t offset = 0) -> const Token&
+ {
+  if (is_at_end(offset)) return m_eof_token;
+  return m_lookahead[offset];
+ }
+
+ /**
+  * Returns true if the top token is the same as `expected`.
+  */
+ [[nodiscard]] auto front_is(TokenType expected) -> bool
+ {
+  return peek().is(expected);
+ }
+
+ /**
+  * Returns true if the given sequence is found, starting from the top.
+  */
+ template <std::same_as<TokenType>... TokenTypes>
+ [[nodiscard]] auto match_sequence(TokenTypes... tokens) -> bool
+ {
+  std::size_t offset {0};
+  return ((peek(offset++).type == tokens) && ...);
+ }
+
+ /**
+  * Returns the top element and moves onto the next.
+  */
+ [[nodiscard]] auto pop() -> Token
+ {
+  const auto token = peek();
+  advance();
+  return token;
+ }
+
+ /**
+  * Move past the given number of tokens.
+  */
+ auto advance(std::size_t steps = 1) -> void
+ {
+  fill(steps);
+  const auto count = std::min(steps, m_lookahead.size());
+  m_lookahead.erase(m_lookahead.begin(), m_lookahead.begin() + static_cast<std::ptrdiff_t>(count));
+ }
+
+ /**
+  * Returns true if the top element matches any of the tokens specified.
+  */
+ template<std::same_as<TokenType> ...Tokens>
+ [[nodiscard]] auto match(Tokens... tokens) -> bool 
+ {
+  return peek().any_of(tokens...);
+ }
+
+ /**
+  * Advance and return true if the token matches any of the specified token types.
+  */
+ template<std::same_as<TokenType> ...Tokens>
+ [[nodiscard]] auto consume(Tokens... tokens) -> bool 
+ {
+  const bool matched = match(tokens...);
+  if (matched) advance();
+  return matched;
+ }
+
+ /**
+  * While the top element matches one of the TokenTypes, move onto the next.
+  */
+ template<std::same_as<TokenType> ...Tokens>
+ auto skip(Tokens... tokens) -> void
+ {
+  while (!is_at_end() && match(tokens...))
+  {
+   advance();
+  }
+ }
+
+ /**
+  * Move onto the next token of the specified type.
+  */
+ auto skip_until(TokenType token_type) -> void
+ {
+  while (!is_at_end() && !front_is(token_type))
+  {
+   advance();
+  }
+ }
+
+ /**
+  * Retrieve the tokens in the scope created by the head/tail pair, the stream is not advanced.
+  * Note: You are expected to have passed the head token when this is called.
+  */
+ auto between(TokenType head, TokenType tail) -> TokenStream<TokenType>
+ {
+  TokenStream<TokenType> scope_tokens{};
+  std::size_t            scope {1};
+
+  for (std::size_t offset {0}; !peek(offset).is(TokenType::EndOfFile); ++offset)
+  {
+   const auto& tok = peek(offset);
+
+   if (tok.is(head))
+   {
+    scope++;
+   }
+   else if (tok.is(tail) && --scope == 0)
+   {
+    break;
+   }
+
+   scope_tokens.push_back(tok);
+  }
+
+  return scope_tokens;
+ }
+
+ /**
+  * Move past the tail which closes the current scope (the head has already been passed), or to
+  * the end of the stream if the scope is never closed.
+  */
+ auto skip_scope(TokenType head, TokenType tail) -> void
+ {
+  std::size_t scope {1};
+  while (!is_at_end() && !front_is(TokenType::EndOfFile))
+  {
+   const auto type = pop().type;
+   if (type == head)
+   {
+    scope++;
+   }
+   else if (type == tail && --scope == 0)
+   {
+    return;
+   }
+  }
+ }
+
+ /**
+  * Time spent scanning, and the number of tokens scanned.
+  */
+ struct ScanStats
+ {
+  std::chrono::steady_clock::duration time {};
+  std::size_t                         tokens {0};
+ };
+
+ /**
+  * Count the tokens scanned from now on, and the time spent scanning them, into `stats`.
+  * Nothing is counted if it is null.
+  */
+ auto collect_stats(ScanStats* stats) noexcept -> void
+ {
+  m_stats = stats;
+ }
+
+ /**
+  * Drop the source buffers which are only referenced by tokens that have been consumed.
+  */
+ auto release_consumed() -> void
+ {
+  const SourceBuffer* keep_from = m_lookahead.empty() ? nullptr : m_lookahead.front().source;
+  while (!m_pins.empty() && m_pins.front().get() != keep_from)
+  {
+   m_pins.pop_front();
+  }
+ }
+
+ private:
+ /**
+  * Scan until the lookahead buffer holds `count` tokens, or the source is exhausted. The scan
+  * is counted if statistics are collected, see collect_stats().
+  */
+ auto fill(std::size_t count) -> void
+ {
+  if (m_lookahead.size() >= count || is_exhausted()) return;
+
+  if (m_stats != nullptr) [[unlikely]]
+  {
+   const auto started = std::chrono::steady_clock::now();
+   const auto before  = m_lookahead.size();
+   scan(count);
+   m_stats->time += std::chrono::steady_clock::now() - started;
+   m_stats->tokens += m_lookahead.size() - before;
+   return;
+  }
+
+  scan(count);
+ }
+
+ /**
+  * Returns true once every token of the source has been scanned.
+  */
+ [[nodiscard]] auto is_exhausted() -> bool
+ {
+  return m_parallel.has_value() ? m_batch_begin >= m_source_size : m_scanner.is_at_end();
+ }
+
+ /**
+  * Scan into the lookahead buffer, see fill(). A parallel scan adds a whole batch at a time.
+  */
+ auto scan(std::size_t count) -> void
+ {
+  if (m_parallel.has_value())
+  {
+   while (m_lookahead.size() < count && m_batch_begin < m_source_size)
+   {
+    const auto batch_end = m_parallel->line_start_after(m_batch_begin + m_batch_size);
+    m_parallel->scan(m_batch_begin, batch_end, [this](const Token& token) { take(token); });
+    m_batch_begin = batch_end;
+
+    if (m_batch_begin >= m_source_size)
+    {
+     if (const auto end = m_parallel->end_token()) take(*end);
+    }
+   }
+   return;
+  }
+
+  while (m_lookahead.size() < count && !m_scanner.is_at_end())
+  {
+   take(m_scanner.scan_token());
+  }
+ }
+
+ /**
+  * Add the token to the lookahead buffer, pinning its source.
+  */
+ auto take(const Token& token) -> void
+ {
+  if (token.source != nullptr && (m_pins.empty() || m_pins.back().get() != token.source))
+  {
+   m_pins.push_back(token.source->shared_from_this());
+  }
+  m_lookahead.push_back(token);
+ }
+
+
+ /**
+  * Members.
+  */
+ Scanner           m_scanner {};
+ std::deque<Token> m_lookahead {};
+
+ // Buffers referenced by the tokens handed out since the last release, oldest first.
+ std::deque<std::shared_ptr<const SourceBuffer>> m_pins {};
+
+ // Where the scan is counted, if it is.
+ ScanStats* m_stats {nullptr};
+
+ // Set when the source is scanned in parallel, in batches of m_batch_size bytes.
+ std::optional<ParallelScan<TokenType>> m_parallel {};
+ std::size_t                            m_source_size {0};
+ std::size_t                            m_batch_size {0};
+ std::size_t                            m_batch_begin {0};
+
+ inline static Token m_eof_token = Token();
 };
 
 /* TokenStream */
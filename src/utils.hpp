@@ -6,11 +6,7 @@
 
 #include <map>
 #include <optional>
-
-/**
- * Join two tokens together.
- */
-#define _JOIN(a, b) a##b
+#include <string_view>
 
 namespace macten
 {
@@ -37,50 +33,37 @@ inline auto map_raw_args_string_to_names(const std::vector<std::string>& names,
 
     const std::size_t expected_argcount = names.size();
 
-    uint8_t argcount{0}, brace_scope{0}, square_scope{0}, paren_scope{0};
+    uint8_t argcount{0};
 
     AllTokenStream ts_buffer{};
 
     while (!view.is_at_end())
     {
+        const auto index = view.position();
         const auto token = view.pop();
 
-        switch (token.type)
+        if (token.is(TokenType::Comma))
         {
-#define SCOPE_CASE(Name, name)                                                                     \
-    break; case _JOIN(TokenType::L, Name):                                                         \
-    {                                                                                              \
-        _JOIN(name, _scope++);                                                                     \
-        ts_buffer.push_back(token);                                                                \
-    }                                                                                              \
-    break; case _JOIN(TokenType::R, Name):                                                         \
-    {                                                                                              \
-        _JOIN(name, _scope)--;                                                                     \
-        ts_buffer.push_back(token);                                                                \
-    }
-            SCOPE_CASE(Paren, paren)
-            SCOPE_CASE(Square, square)
-            SCOPE_CASE(Brace, brace)
-#undef SCOPE_CASE
-            break; case TokenType::Comma:
+            if (argcount < expected_argcount)
             {
-                if (brace_scope == 0 && square_scope == 0 && paren_scope == 0)
-                {
-                    if (argcount < expected_argcount)
-                    {
-                        mapping[names[argcount]] = ts_buffer.construct();
-                        argcount++;
-                    }
-                    ts_buffer.clear();
-                }
-                else
-                {
-                    ts_buffer.push_back(token);
-                }
+                mapping[names[argcount]] = ts_buffer.construct();
+                argcount++;
             }
-            break; default:
+            ts_buffer.clear();
+            continue;
+        }
+
+        ts_buffer.push_back(token);
+
+        // Nested scopes are taken whole, commas inside them do not separate arguments. An
+        // unclosed scope runs to the end.
+        if (AllTokenStream::is_opening_bracket(token.type))
+        {
+            const auto close = ts.matching_bracket(index);
+            const auto end   = close == AllTokenStream::no_match ? ts.size() : close + 1;
+            while (view.position() < end && !view.is_at_end())
             {
-                ts_buffer.push_back(token);
+                ts_buffer.push_back(view.pop());
             }
         }
     }
@@ -99,6 +82,69 @@ inline auto map_raw_args_string_to_names(const std::vector<std::string>& names,
     return mapping;
 }
 
+/**
+ * Join two tokens into one, keeping the type of the head token. Tokens which sit next to each
+ * other in the same source buffer are joined by widening the lexeme view, otherwise the joined
+ * lexeme is synthesized into a buffer owned by `owner`, a token stream or rope.
+ */
+template <typename TokenType, typename Owner>
+inline auto join_tokens(Owner& owner, const cpp20scanner::Token<TokenType>& head,
+                        const cpp20scanner::Token<TokenType>& tail) -> cpp20scanner::Token<TokenType>
+{
+    const auto head_end = head.lexeme.data() + head.lexeme.size();
+
+    if (head.source != nullptr && head.source == tail.source && head_end == tail.lexeme.data())
+    {
+        auto joined   = head;
+        joined.lexeme = std::string_view(head.lexeme.data(), head.lexeme.size() + tail.lexeme.size());
+        return joined;
+    }
+
+    std::string lexeme{head.lexeme};
+    lexeme += tail.lexeme;
+    return owner.make_owned(head.type, std::move(lexeme));
+}
+
+/**
+ * Append the tokens [begin, end) of `source` to `stream`. The first of them are joined into the
+ * token at the back of the stream for as long as the two scan as a single token, as they would if
+ * the stream were written out and scanned again. This is how a substituted argument runs into its
+ * neighbours, e.g. `$a$b`.
+ */
+template <typename TokenType>
+inline auto append_rejoined(macten::TokenStream<TokenType>& stream, const macten::TokenStream<TokenType>& source,
+                            std::size_t begin, std::size_t end) -> void
+{
+    while (begin < end && !stream.empty())
+    {
+        const auto head = stream.peek_back();
+        const auto tail = source.get(begin);
+
+        // Only identifier characters and digits can run into each other.
+        if (head.lexeme.empty() || tail.lexeme.empty() ||
+            !cpp20scanner::classify::is_identifier(head.lexeme.back()) ||
+            !cpp20scanner::classify::is_identifier(tail.lexeme.front()))
+            break;
+
+        std::string lexeme{head.lexeme};
+        lexeme += tail.lexeme;
+
+        typename TokenType::Scanner scanner{};
+        scanner.set_source(lexeme);
+        const auto rescanned = scanner.scan_token();
+        if (rescanned.lexeme.size() != lexeme.size())
+            break;
+
+        stream.pop_back();
+        auto joined = join_tokens(stream, head, tail);
+        joined.type = rescanned.type;
+        stream.push_back(joined);
+        begin++;
+    }
+
+    stream.append(source, begin, end);
+}
+
 /**
  * Checks whether the upcoming sequence in view matches a macro call: `<ident>![`.
  */
@@ -111,6 +157,4 @@ inline auto is_macro_call(typename macten::TokenStream<MactenAllToken>::TokenStr
 } // namespace utils
 } // namespace macten
 
-#undef _JOIN
-
 #endif /* MACTEN_UTILS_H */